@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "config.h"
+#include "utils.h"
+#include "argbatch.h"
+
+extern char ** environ;
+
+static int jobs = ARG_BATCH_JOBS;
+
+void ab_set_jobs(int new_jobs) {
+	jobs = new_jobs;
+}
+
+int ab_jobs() {
+	return jobs;
+}
+
+/* Bytes an argument or environment string takes on the new stack */
+static size_t _ab_size(const char * str) {
+	return strlen(str) + 1 + sizeof(char *);
+}
+
+/* Room for the arguments of one exec */
+static long _ab_limit() {
+	long limit;
+	char ** env;
+
+	limit = sysconf(_SC_ARG_MAX);
+	if (limit <= 0) {
+		limit = ARG_BATCH_FALLBACK_MAX;
+	}
+	for (env = environ; *env != NULL; ++env) {
+		limit -= _ab_size(*env);
+	}
+	return limit - ARG_BATCH_HEADROOM;
+}
+
+/* Number of leading words kept in every batch */
+static int _ab_fixed(char ** argv) {
+	int i;
+
+	for (i = 1; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+		if (strcmp(argv[i], "--") == 0) {
+			return i + 1;
+		}
+	}
+	return i;
+}
+
+int ab_needed(char ** argv) {
+	long size;
+	int i;
+
+	if (jobs == AB_OFF) {
+		return 0;
+	}
+	size = 0;
+	for (i = 0; argv[i] != NULL; ++i) {
+		size += _ab_size(argv[i]);
+	}
+	return size > _ab_limit() && argv[_ab_fixed(argv)] != NULL;
+}
+
+typedef struct ab_batch {
+	pid_t pid;
+	int index; /* order of the batch in argv */
+} ab_batch;
+
+/* Waits for any of the running batches and removes it from them. Of the
+   batches that failed, result keeps the status of the first one in argv
+   order, failed its index. */
+static void _ab_wait(ab_batch * running, int * count, int * result, int * failed) {
+	int status, i;
+	pid_t pid;
+
+	do {
+		EINTR_RETRY(pid, waitpid(-1, &status, 0));
+		if (pid == -1) {
+			*count = 0; /* no children left to wait for */
+			return;
+		}
+		for (i = 0; i < *count && running[i].pid != pid; ++i);
+	} while (i == *count);
+
+	if (running[i].index < *failed) {
+		if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+			*result = WEXITSTATUS(status);
+			*failed = running[i].index;
+		} else if (WIFSIGNALED(status)) {
+			*result = 128 + WTERMSIG(status);
+			*failed = running[i].index;
+		}
+	}
+	running[i] = running[--*count];
+}
+
+int ab_run(char ** argv, const char * path) {
+	char ** batch;
+	ab_batch * running;
+	long limit, fixed_size, size;
+	int argc, fixed, i, n, count, index, result, failed;
+	pid_t pid;
+
+	for (argc = 0; argv[argc] != NULL; ++argc);
+	batch = malloc((argc + 1) * sizeof(char *));
+	running = malloc(jobs * sizeof(ab_batch));
+	if (batch == NULL || running == NULL) {
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+		free(batch);
+		free(running);
+		return EXEC_FAILURE;
+	}
+	fixed = _ab_fixed(argv);
+	fixed_size = 0;
+	for (i = 0; i < fixed; ++i) {
+		batch[i] = argv[i];
+		fixed_size += _ab_size(argv[i]);
+	}
+	limit = _ab_limit();
+
+	result = 0;
+	failed = argc; /* more than the index of any batch */
+	count = 0;
+	for (i = fixed, index = 0; i < argc; ++index) {
+		/* at least one argument, exec reports one that can't fit at all */
+		size = fixed_size;
+		n = fixed;
+		do {
+			size += _ab_size(argv[i]);
+			batch[n++] = argv[i++];
+		} while (i < argc && size + (long) _ab_size(argv[i]) <= limit);
+		batch[n] = NULL;
+
+		if (count == jobs) {
+			_ab_wait(running, &count, &result, &failed);
+		}
+		pid = fork();
+		if (pid == -1) {
+			fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+			if (index < failed) {
+				result = EXEC_FAILURE;
+				failed = index;
+			}
+			break;
+		}
+		if (pid == 0) {
+			if (path != NULL && path != argv[0]) {
+				execv(path, batch);
+			}
+			execvp(batch[0], batch);
+			fprintf(stderr, "%s: %s\n", batch[0], strerror(errno));
+			_exit(EXEC_FAILURE);
+		}
+		running[count].pid = pid;
+		running[count].index = index;
+		++count;
+	}
+
+	while (count > 0) {
+		_ab_wait(running, &count, &result, &failed);
+	}
+	free(batch);
+	free(running);
+	return result;
+}
@@ -0,0 +1,93 @@
+/*
+ * Parser benchmark.
+ *
+ * Parses every line of stdin N times (1000 by default) with parseline and
+ * reports lines and megabytes parsed per second. Without a script on stdin a
+ * built-in sample of typical command lines is used.
+ *
+ *     make bench/parse && bench/parse [N] < script
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "siparse.h"
+
+static const char * sample[] = {
+	"ls -l /usr/bin",
+	"cat /etc/passwd | grep root | cut -d: -f1 > /tmp/users",
+	"echo a b c d e f g h i j k l m n o p q r s t u v w x y z",
+	"make -j4 all >> build.log ; make install < /dev/null &",
+	"sort < input | uniq -c | sort -n | tail -n 10 # top ten",
+	"cd /tmp ; lls ; lcd .. ; lecho done",
+	NULL
+};
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+	char ** lines, * line;
+	size_t count, capacity, size, i;
+	ssize_t length;
+	long n, j, parsed, bytes, errors;
+	double start, end;
+
+	n = argc > 1 ? atol(argv[1]) : 1000;
+
+	count = 0;
+	capacity = sizeof(sample) / sizeof(sample[0]);
+	lines = malloc(capacity * sizeof(char *));
+	if (lines == NULL) {
+		perror("init");
+		return 1;
+	}
+	if (!isatty(STDIN_FILENO)) {
+		line = NULL;
+		size = 0;
+		while ((length = getline(&line, &size, stdin)) != -1) {
+			if (length > 0 && line[length - 1] == '\n') {
+				line[length - 1] = '\0';
+			}
+			if (count == capacity) {
+				capacity *= 2;
+				lines = realloc(lines, capacity * sizeof(char *));
+			}
+			if (lines == NULL || (lines[count++] = strdup(line)) == NULL) {
+				perror("read");
+				return 1;
+			}
+		}
+		free(line);
+	}
+	if (count == 0) {
+		for (; sample[count] != NULL; ++count) {
+			lines[count] = (char *) sample[count];
+		}
+	}
+
+	parsed = bytes = errors = 0;
+	start = now();
+	for (j = 0; j < n; ++j) {
+		for (i = 0; i < count; ++i) {
+			if (parseline(lines[i]) == NULL) {
+				++errors;
+			}
+			++parsed;
+			bytes += strlen(lines[i]) + 1;
+		}
+	}
+	end = now();
+
+	printf("{\"bench\": \"parse\", \"lines\": %ld, \"bytes\": %ld, \"errors\": %ld, \"seconds\": %.6f, \"lines_per_second\": %.0f, \"mb_per_second\": %.2f}\n",
+	    parsed, bytes, errors, end - start, parsed / (end - start), bytes / (end - start) / 1e6);
+
+	return 0;
+}
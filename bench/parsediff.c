@@ -0,0 +1,165 @@
+/*
+ * Differential test of the two parsers.
+ *
+ * Built once against the hand-written parser (bench/parsediff-rd) and once
+ * against the flex/yacc one (bench/parsediff-yacc). Both parse the same
+ * corpus: every sequence of up to three of the fragments below, then LINES
+ * (200000 by default) random sequences of up to MAX_FRAGMENTS of them
+ * generated from SEED. For each line they print the line, the structure
+ * parseline built from it and the here-document delimiters nextheredoc
+ * finds in it, so the outputs must be identical.
+ *
+ *     make parsediff
+ *     bench/parsediff-rd [LINES [SEED]] > rd.out
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "siparse.h"
+
+#define MAX_FRAGMENTS 12
+#define EXHAUSTIVE_LENGTH 3
+
+/* Tokens of the language and pieces of them glued together without
+   blanks, so the corpus also covers words cut short by operators. Random
+   lines take every other fragment from the first PLAIN_FRAGMENTS ones, so
+   fewer of them are syntax errors. */
+#define PLAIN_FRAGMENTS 8
+
+static const char * fragments[] = {
+	" ", "\t", "\n", "ls", "-l", "a.txt", "k", "4",
+	"|", "|[4k]", "|[16]", "|[2M]", "|[0]", "|[", "]", "|[x]",
+	";", "&", "<", ">", ">>", "<<", "<<<",
+	"<(ls -l)", ">(cat)", "<(", ")", "(",
+	"#", "# c",
+	NULL
+};
+
+static int fragments_count;
+static unsigned long seed = 1;
+
+/* Own generator, so both builds see the same corpus on any libc */
+static unsigned long next_random() {
+	seed = seed * 1103515245UL + 12345UL;
+	return (seed >> 16) & 0x7fff;
+}
+
+static void print_quoted(const char * s) {
+	putchar('"');
+	for (; *s != '\0'; ++s) {
+		if (*s == '\n') {
+			fputs("\\n", stdout);
+		} else if (*s == '\t') {
+			fputs("\\t", stdout);
+		} else if (*s == '"' || *s == '\\') {
+			printf("\\%c", *s);
+		} else {
+			putchar(*s);
+		}
+	}
+	putchar('"');
+}
+
+static void dump(const char * text) {
+	line * ln;
+	pipeline * pl;
+	command ** com;
+	char ** arg;
+	redirection ** redir;
+	const char * word;
+	size_t length;
+
+	print_quoted(text);
+	printf(" heredocs");
+	for (word = text; (word = nextheredoc(word, &length)) != NULL; word += length) {
+		printf(" %d:%d", (int) (word - text), (int) length);
+	}
+	ln = parseline(text);
+	if (ln == NULL) {
+		puts(" error");
+		return;
+	}
+	printf(" flags %d", ln->flags);
+	for (pl = ln->pipelines; *pl != NULL; ++pl) {
+		printf(" [");
+		for (com = *pl; *com != NULL; ++com) {
+			printf(" (%d", (*com)->pipesize);
+			for (arg = (*com)->argv; *arg != NULL; ++arg) {
+				putchar(' ');
+				print_quoted(*arg);
+			}
+			for (redir = (*com)->redirs; *redir != NULL; ++redir) {
+				printf(" %d:", (*redir)->flags);
+				print_quoted((*redir)->filename);
+			}
+			putchar(')');
+		}
+		printf(" ]");
+	}
+	putchar('\n');
+}
+
+/* Parses every sequence of length fragments, appended to text at end */
+static void exhaustive(char * text, size_t end, int length) {
+	int i;
+	size_t size;
+
+	if (length == 0) {
+		text[end] = '\0';
+		dump(text);
+		return;
+	}
+	for (i = 0; i < fragments_count; ++i) {
+		size = strlen(fragments[i]);
+		memcpy(text + end, fragments[i], size);
+		exhaustive(text, end + size, length - 1);
+	}
+}
+
+int main(int argc, char * argv[]) {
+	char * text;
+	const char * fragment;
+	size_t longest, end, size;
+	long lines, i;
+	int length, n, j;
+
+	lines = argc > 1 ? atol(argv[1]) : 200000;
+	if (argc > 2) {
+		seed = strtoul(argv[2], NULL, 10);
+	}
+
+	longest = 0;
+	for (fragments_count = 0; fragments[fragments_count] != NULL; ++fragments_count) {
+		if (strlen(fragments[fragments_count]) > longest) {
+			longest = strlen(fragments[fragments_count]);
+		}
+	}
+	text = malloc(longest * MAX_FRAGMENTS + 1);
+	if (text == NULL) {
+		perror("parsediff");
+		return 1;
+	}
+
+	for (length = 1; length <= EXHAUSTIVE_LENGTH; ++length) {
+		exhaustive(text, 0, length);
+	}
+
+	for (i = 0; i < lines; ++i) {
+		n = 1 + next_random() % MAX_FRAGMENTS;
+		end = 0;
+		for (j = 0; j < n; ++j) {
+			fragment = fragments[next_random() % (j % 2 ? PLAIN_FRAGMENTS : fragments_count)];
+			size = strlen(fragment);
+			memcpy(text + end, fragment, size);
+			end += size;
+		}
+		text[end] = '\0';
+		dump(text);
+	}
+
+	free(text);
+	return 0;
+}
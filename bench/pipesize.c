@@ -0,0 +1,117 @@
+/*
+ * Pipe capacity benchmark.
+ *
+ * For each capacity from 4 KiB to the system maximum, doubling it, a child
+ * writes MB megabytes (256 by default) in 4 KiB writes into a pipe resized
+ * with ps_apply, like exec_pipeline does for |[SIZE], and the parent reads
+ * and sums them. Reports the throughput and the context switches of both
+ * processes for every capacity.
+ *
+ *     make bench/pipesize && bench/pipesize [MB]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "pipesize.h"
+
+#define WRITE_SIZE 4096
+#define READ_SIZE (1 << 20)
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long context_switches(int who) {
+	struct rusage ru;
+	getrusage(who, &ru);
+	return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+void writer(int fd, long total) {
+	static char data[WRITE_SIZE];
+	ssize_t result;
+
+	memset(data, 'x', sizeof(data));
+	for (; total > 0; total -= result) {
+		EINTR_RETRY(result, write(fd, data, sizeof(data)));
+		if (result == -1) {
+			_exit(1);
+		}
+	}
+	_exit(0);
+}
+
+/* Returns the sum of the bytes read, so the reader does some work */
+unsigned long reader(int fd) {
+	static unsigned char data[READ_SIZE];
+	unsigned long sum;
+	ssize_t result, i;
+
+	sum = 0;
+	for (;;) {
+		EINTR_RETRY(result, read(fd, data, sizeof(data)));
+		if (result <= 0) {
+			return sum;
+		}
+		for (i = 0; i < result; ++i) {
+			sum += data[i];
+		}
+	}
+}
+
+int main(int argc, char * argv[]) {
+	long total, switches;
+	int size, p[2], status;
+	pid_t pid;
+	double start, end;
+	unsigned long sum;
+
+	total = (argc > 1 ? atol(argv[1]) : 256) << 20;
+
+	for (size = 4096; size <= ps_max_size(); size *= 2) {
+		if (pipe(p) == -1 || ps_apply(p[1], size) == -1) {
+			perror("pipe");
+			return 1;
+		}
+
+		switches = context_switches(RUSAGE_SELF) + context_switches(RUSAGE_CHILDREN);
+		start = now();
+		pid = fork();
+		if (pid == -1) {
+			perror("fork");
+			return 1;
+		}
+		if (pid == 0) {
+			close(p[0]);
+			writer(p[1], total);
+		}
+		close(p[1]);
+		sum = reader(p[0]);
+		close(p[0]);
+		EINTR_RETRY(pid, waitpid(pid, &status, 0));
+		end = now();
+		switches = context_switches(RUSAGE_SELF) + context_switches(RUSAGE_CHILDREN) - switches;
+
+		if (sum != (unsigned long) total * 'x') {
+			fprintf(stderr, "pipesize: lost data\n");
+			return 1;
+		}
+		printf("{\"bench\": \"pipesize\", \"pipe_size\": %d, \"megabytes\": %ld, \"seconds\": %.6f, \"mb_per_second\": %.0f, \"context_switches\": %ld}\n",
+		    size, total >> 20, end - start, (total >> 20) / (end - start), switches);
+		fflush(stdout);
+	}
+	return 0;
+}
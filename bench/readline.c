@@ -0,0 +1,54 @@
+/*
+ * Line reader benchmark.
+ *
+ * Reads stdin through lr_readline until EOF and reports lines per second.
+ * Use a regular file as stdin to measure the mmap path and a pipe to measure
+ * the read path:
+ *
+ *     make bench/readline
+ *     bench/readline < script
+ *     cat script | bench/readline
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "linereader.h"
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+	struct linereader lr;
+	const char * line;
+	long lines, bytes;
+	double start, end;
+	struct stat st;
+
+	if (lr_init(&lr) == -1) {
+		perror("lr_init");
+		return 1;
+	}
+
+	lines = bytes = 0;
+	start = now();
+	while (lr_readline(&lr, &line) == 0 && line != NULL) {
+		++lines;
+		bytes += strlen(line) + 1;
+	}
+	end = now();
+
+	fstat(STDIN_FILENO, &st);
+	printf("{\"bench\": \"readline\", \"input\": \"%s\", \"lines\": %ld, \"bytes\": %ld, \"seconds\": %.6f, \"lines_per_second\": %.0f}\n",
+	    S_ISREG(st.st_mode) ? "file" : "pipe", lines, bytes, end - start, lines / (end - start));
+
+	lr_clean(&lr);
+	return 0;
+}
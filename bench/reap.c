@@ -0,0 +1,91 @@
+/*
+ * Reaping benchmark for the processgroups module.
+ *
+ * Starts N children (10000 by default), each in its own group like a
+ * background job, keeps them all alive until every one is registered and then
+ * lets them exit at once. Reports how long it took to reap all of them.
+ *
+ *     make bench/reap && bench/reap [N]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "utils.h"
+#include "processgroups.h"
+
+static int finished = 0;
+
+void group_finished(int pgn) {
+	++finished;
+	pg_del(pgn);
+}
+
+double user_time() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+}
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+	int i, n, pgn, result;
+	int p[2];
+	char c;
+	pid_t pid;
+	double start, end, user_start, user_seconds;
+
+	n = argc > 1 ? atoi(argv[1]) : 10000;
+
+	if (pg_init() == -1 || pipe(p) == -1) {
+		perror("init");
+		return 1;
+	}
+
+	pg_block_sigchld();
+	for (i = 0; i < n; ++i) {
+		pgn = pg_new(group_finished);
+		pid = fork();
+		if (pid == -1) {
+			perror("fork");
+			return 1;
+		}
+		if (pid == 0) {
+			close(p[1]);
+			EINTR_RETRY(result, read(p[0], &c, 1));
+			_exit(0);
+		}
+		if (pgn == -1 || pg_add_process(pgn, pid, NULL) == -1) {
+			perror("pg_add_process");
+			return 1;
+		}
+	}
+
+	start = now();
+	user_start = user_time();
+	close(p[1]);
+	while (finished < n) {
+		pg_wait_for_sigchld();
+	}
+	end = now();
+	user_seconds = user_time() - user_start;
+	pg_unblock_sigchld();
+
+	printf("{\"bench\": \"reap\", \"children\": %d, \"seconds\": %.6f, \"user_seconds\": %.6f, \"per_second\": %.0f}\n",
+	    n, end - start, user_seconds, n / (end - start));
+
+	pg_clean();
+	return 0;
+}
@@ -0,0 +1,97 @@
+#!/bin/sh
+#
+# End-to-end benchmarks, run by make bench from the top directory.
+#
+# Prints one JSON object per line:
+#   trivial   - a trivial external command per line
+#   pipeline  - a STAGES long pipeline of trivial commands per line
+#   lines     - many short lines running a builtin
+#   reap, parse, readline, pipesize - the benchmarks in bench/*.c
+#
+# With -c the script based benchmarks also run with every other shell found
+# on the machine. Sizes can be changed with the variables below, e.g.
+#
+#     make bench BENCH_ARGS=-c
+#     N=1000 STAGES=8 sh bench/run.sh
+
+N=${N:-2000}             # lines of the trivial and pipeline scripts
+STAGES=${STAGES:-4}
+LINES=${LINES:-200000}   # lines of the many short lines script
+CHILDREN=${CHILDREN:-10000}
+PARSE_ROUNDS=${PARSE_ROUNDS:-100000}
+READ_LINES=${READ_LINES:-3000000}
+PIPE_MB=${PIPE_MB:-256}  # megabytes sent through a pipe of each size
+
+COMPARE=0
+if [ "$1" = "-c" ]; then
+	COMPARE=1
+fi
+
+TMP=${TMPDIR:-/tmp}/mshell-bench.$$
+mkdir -p "$TMP" || exit 1
+trap 'rm -rf "$TMP"' 0 INT TERM
+
+TRUE=`command -v true`
+case "$TRUE" in
+/*) ;;
+*) TRUE=/bin/true ;;   # true is a builtin, use the program
+esac
+
+# repeat COUNT LINE: prints LINE COUNT times
+repeat() {
+	awk -v n="$1" -v l="$2" 'BEGIN { for (i = 0; i < n; i++) print l }'
+}
+
+repeat "$N" "$TRUE" > "$TMP/trivial"
+
+PIPE=$TRUE
+i=1
+while [ $i -lt "$STAGES" ]; do
+	PIPE="$PIPE | $TRUE"
+	i=`expr $i + 1`
+done
+repeat "$N" "$PIPE" > "$TMP/pipeline"
+
+repeat "$LINES" "cd ." > "$TMP/lines"
+
+# report NAME SHELL COUNT UNIT SECONDS
+report() {
+	awk -v b="$1" -v s="$2" -v n="$3" -v u="$4" -v t="$5" 'BEGIN {
+		printf "{\"bench\": \"%s\", \"shell\": \"%s\", \"%s\": %d, \"seconds\": %.6f, \"per_second\": %.0f, \"microseconds_each\": %.2f}\n",
+		    b, s, u, n, t, n / t, t * 1e6 / n
+	}'
+}
+
+# run_shell NAME SHELL...
+run_shell() {
+	name=$1
+	shift
+	for bench in trivial pipeline lines; do
+		case $bench in
+		trivial) count=$N ;;
+		pipeline) count=$N ;;
+		lines) count=$LINES ;;
+		esac
+		seconds=`bench/timeit "$TMP/$bench" "$@"` || continue
+		report "$bench" "$name" "$count" lines "$seconds"
+	done
+}
+
+run_shell mshell ./mshell
+
+bench/reap "$CHILDREN"
+bench/parse "$PARSE_ROUNDS" < /dev/null
+awk -v n="$READ_LINES" 'BEGIN { for (i = 0; i < n; i++) print "echo line", i }' > "$TMP/read"
+bench/readline < "$TMP/read"
+cat "$TMP/read" | bench/readline
+bench/pipesize "$PIPE_MB"
+
+if [ $COMPARE -eq 1 ]; then
+	for sh in dash bash ksh mksh zsh busybox; do
+		path=`command -v $sh` || continue
+		case $sh in
+		busybox) run_shell busybox "$path" sh ;;
+		*) run_shell "$sh" "$path" ;;
+		esac
+	done
+fi
@@ -0,0 +1,65 @@
+/*
+ * Runs a command with stdin read from a file and stdout discarded, and
+ * prints the wall clock time it took in seconds. Used by bench/run.sh,
+ * which can't measure short times portably in sh.
+ *
+ *     bench/timeit script mshell
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+	int in, out, status, result;
+	pid_t pid;
+	double start, end;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s input command [args...]\n", argv[0]);
+		return 2;
+	}
+
+	in = open(argv[1], O_RDONLY);
+	out = open("/dev/null", O_WRONLY);
+	if (in == -1 || out == -1) {
+		perror(argv[1]);
+		return 2;
+	}
+
+	start = now();
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return 2;
+	}
+	if (pid == 0) {
+		dup2(in, STDIN_FILENO);
+		dup2(out, STDOUT_FILENO);
+		execvp(argv[2], argv + 2);
+		perror(argv[2]);
+		_exit(127);
+	}
+	EINTR_RETRY(result, waitpid(pid, &status, 0));
+	end = now();
+
+	if (result == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "%s: failed\n", argv[2]);
+		return 1;
+	}
+	printf("%.6f\n", end - start);
+	return 0;
+}
@@ -4,13 +4,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <sys/wait.h>
+#include <dlfcn.h>
 
 #include "builtins.h"
+#include "config.h"
+#include "siparse.h"
 #include "utils.h"
+#include "pathcache.h"
+#include "linecache.h"
+#include "rewrite.h"
+#include "fdcopy.h"
+#include "pipesize.h"
+#include "processgroups.h"
+#include "coprocess.h"
+#include "parallel.h"
+#include "argbatch.h"
 
 int builtin_echo(int, char * argv[]);
 int builtin_undefined(int, char * argv[]);
@@ -19,6 +33,24 @@ int builtin_cd(int argc, char * argv[]);
 int builtin_lcd(int argc, char * argv[]);
 int builtin_lkill(int argc, char * argv[]);
 int builtin_lls(int argc, char * argv[]);
+int builtin_lcat(int argc, char * argv[]);
+int builtin_ltee(int argc, char * argv[]);
+int builtin_hash(int argc, char * argv[]);
+int builtin_linecache(int argc, char * argv[]);
+int builtin_rewrite(int argc, char * argv[]);
+int builtin_pipesize(int argc, char * argv[]);
+int builtin_enable(int argc, char * argv[]);
+int builtin_maxjobs(int argc, char * argv[]);
+int builtin_jobs(int argc, char * argv[]);
+int builtin_fg(int argc, char * argv[]);
+int builtin_bg(int argc, char * argv[]);
+int builtin_wait(int argc, char * argv[]);
+int builtin_coproc(int argc, char * argv[]);
+int builtin_cowrite(int argc, char * argv[]);
+int builtin_coread(int argc, char * argv[]);
+int builtin_coclose(int argc, char * argv[]);
+int builtin_parallel(int argc, char * argv[]);
+int builtin_argbatch(int argc, char * argv[]);
 
 builtin_pair builtins_table[]={
 	{"exit",	&builtin_exit},
@@ -27,19 +59,132 @@ builtin_pair builtins_table[]={
 	{"lcd",		&builtin_lcd},
 	{"lkill",	&builtin_lkill},
 	{"lls",		&builtin_lls},
+	{"lcat",	&builtin_lcat},
+	{"ltee",	&builtin_ltee},
+	{"hash",	&builtin_hash},
+	{"linecache",	&builtin_linecache},
+	{"rewrite",	&builtin_rewrite},
+	{"pipesize",	&builtin_pipesize},
+	{"enable",	&builtin_enable},
+	{"maxjobs",	&builtin_maxjobs},
+	{"jobs",	&builtin_jobs},
+	{"fg",		&builtin_fg},
+	{"bg",		&builtin_bg},
+	{"wait",	&builtin_wait},
+	{"coproc",	&builtin_coproc},
+	{"cowrite",	&builtin_cowrite},
+	{"coread",	&builtin_coread},
+	{"coclose",	&builtin_coclose},
+	{"parallel",	&builtin_parallel},
+	{"argbatch",	&builtin_argbatch},
 	{NULL,NULL}
 };
 
-builtin_func get_builtin(const char * name) {
+#define REGISTRY_BUCKETS 64 /* power of two */
+
+typedef struct registry_entry {
+	const char * name;
+	builtin_func func;
+	void * handle;        /* dlopen handle for loaded builtins, NULL for static */
+	struct registry_entry * next;
+} registry_entry;
+
+static registry_entry * registry[REGISTRY_BUCKETS];
+static int registry_initialized = 0;
+
+static registry_entry ** _registry_find(const char * name) {
+	registry_entry ** e;
+
+	e = &registry[hash_str(name) & (REGISTRY_BUCKETS - 1)];
+	while (*e != NULL && strcmp((*e)->name, name) != 0) {
+		e = &(*e)->next;
+	}
+	return e;
+}
+
+static void _registry_free(registry_entry * e) {
+	if (e->handle != NULL) {
+		dlclose(e->handle);
+		free((char *) e->name);
+	}
+	free(e);
+}
+
+/* Adds builtin to the registry replacing the one with the same name,
+   name must be malloced when handle is not NULL */
+static int _registry_add(const char * name, builtin_func func, void * handle) {
+	registry_entry ** pos, * e;
+
+	e = (registry_entry *) malloc(sizeof(registry_entry));
+	if (e == NULL) {
+		return -1;
+	}
+	e->name = name;
+	e->func = func;
+	e->handle = handle;
+
+	pos = _registry_find(name);
+	if (*pos != NULL) {
+		e->next = (*pos)->next;
+		_registry_free(*pos);
+	} else {
+		e->next = NULL;
+	}
+	*pos = e;
+	return 0;
+}
+
+/* Adds the static builtins, except names taken by loaded ones, so it can
+   be retried after a failure. Returns -1 if it has to be retried. */
+static int _registry_init() {
 	builtin_pair * builtin;
+
+	for (builtin = builtins_table; builtin->name != NULL; ++builtin) {
+		if (*_registry_find(builtin->name) == NULL
+		  && _registry_add(builtin->name, builtin->func, NULL) == -1) {
+			return -1;
+		}
+	}
+	registry_initialized = 1;
+	return 0;
+}
+
+/* The static builtin a loaded one named name shadows, if any */
+static builtin_pair * _registry_static(const char * name) {
+	builtin_pair * builtin;
+
 	for (builtin = builtins_table; builtin->name != NULL; ++builtin) {
 		if (strcmp(builtin->name, name) == 0) {
-			return builtin->func;
+			return builtin;
 		}
 	}
 	return NULL;
 }
 
+builtin_func get_builtin(const char * name) {
+	registry_entry * e;
+
+	if (!registry_initialized) {
+		_registry_init();
+	}
+	e = *_registry_find(name);
+	return e != NULL ? e->func : NULL;
+}
+
+void builtins_clean() {
+	int i;
+	registry_entry * e, * next;
+
+	for (i = 0; i < REGISTRY_BUCKETS; ++i) {
+		for (e = registry[i]; e != NULL; e = next) {
+			next = e->next;
+			_registry_free(e);
+		}
+		registry[i] = NULL;
+	}
+	registry_initialized = 0;
+}
+
 int builtin_undefined(int argc, char * argv[]) {
 	fprintf(stderr, "Command %s undefined.\n", argv[0]);
 	return BUILTIN_ERROR;
@@ -183,3 +328,567 @@ int builtin_lls(int argc, char * argv[]) {
 
 	return BUILTIN_ERROR;
 }
+
+/* A closed reader is the normal end of "lcat file | head", builtins run in the
+   shell see it as EPIPE instead of being killed by SIGPIPE */
+static void print_copy_error(const char * name, const char * file) {
+	if (errno == EPIPE) {
+		return;
+	}
+	if (file != NULL) {
+		fprintf(stderr, "%s: %s: %s\n", name, file, strerror(errno));
+	} else {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+	}
+}
+
+int builtin_lcat(int argc, char * argv[]) {
+	int i, fd, result;
+
+	fflush(stdout);
+	if (argc == 1) {
+		if (fc_copy(STDIN_FILENO, STDOUT_FILENO) == -1) {
+			print_copy_error("lcat", NULL);
+			return 1;
+		}
+		return 0;
+	}
+
+	result = 0;
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-") == 0) {
+			fd = STDIN_FILENO;
+		} else {
+			EINTR_RETRY(fd, open(argv[i], O_RDONLY));
+			if (fd == -1) {
+				fprintf(stderr, "lcat: %s: %s\n", argv[i], strerror(errno));
+				result = 1;
+				continue;
+			}
+		}
+		if (fc_copy(fd, STDOUT_FILENO) == -1) {
+			print_copy_error("lcat", argv[i]);
+			result = 1;
+		}
+		if (fd != STDIN_FILENO) {
+			close(fd);
+		}
+	}
+	return result;
+}
+
+/* ltee [-a] [FILE]... */
+int builtin_ltee(int argc, char * argv[]) {
+	int * outs, n, i, flags, result;
+
+	flags = O_WRONLY | O_CREAT | O_TRUNC;
+	i = 1;
+	if (argc > 1 && strcmp(argv[1], "-a") == 0) {
+		flags = O_WRONLY | O_CREAT | O_APPEND;
+		i = 2;
+	}
+
+	outs = malloc((argc - i + 1) * sizeof(int));
+	if (outs == NULL) {
+		return BUILTIN_ERROR;
+	}
+	result = 0;
+	outs[0] = STDOUT_FILENO;
+	for (n = 1; i < argc; ++i) {
+		EINTR_RETRY(outs[n], open(argv[i], flags, 0666));
+		if (outs[n] == -1) {
+			fprintf(stderr, "ltee: %s: %s\n", argv[i], strerror(errno));
+			result = 1;
+			continue;
+		}
+		++n;
+	}
+
+	fflush(stdout);
+	if (fc_tee(STDIN_FILENO, outs, n) == -1) {
+		print_copy_error("ltee", NULL);
+		result = 1;
+	}
+	for (i = 1; i < n; ++i) {
+		close(outs[i]);
+	}
+	free(outs);
+	return result;
+}
+
+void print_hash_entry(const char * name, const char * path, int hits) {
+	if (path != NULL) {
+		printf("%4d\t%s\n", hits, path);
+	} else {
+		printf("%4d\t%s (not found)\n", hits, name);
+	}
+}
+
+int builtin_hash(int argc, char * argv[]) {
+	int i, result;
+
+	if (argc == 1) {
+		printf("hits\tcommand\n");
+		pc_foreach(print_hash_entry);
+		fflush(stdout);
+		return 0;
+	}
+
+	if (argc == 2 && strcmp(argv[1], "-r") == 0) {
+		pc_clear();
+		return 0;
+	}
+
+	result = 0;
+	for (i = 1; i < argc; ++i) {
+		if (pc_lookup(argv[i]) == NULL) {
+			fprintf(stderr, "hash: %s: not found\n", argv[i]);
+			result = 1;
+		}
+	}
+	return result;
+}
+
+int builtin_linecache(int argc, char * argv[]) {
+	long hits, misses;
+	int entries;
+
+	if (argc == 2 && strcmp(argv[1], "-r") == 0) {
+		lc_clear();
+		return 0;
+	}
+	if (argc != 1) {
+		return BUILTIN_ERROR;
+	}
+
+	lc_stats(&hits, &misses, &entries);
+	printf("hits %ld misses %ld entries %d\n", hits, misses, entries);
+	fflush(stdout);
+	return 0;
+}
+
+int builtin_rewrite(int argc, char * argv[]) {
+	static const char * modes[] = {"off", "on", "dry"};
+	int i;
+
+	if (argc == 1) {
+		printf("%s\n", modes[rw_mode()]);
+		fflush(stdout);
+		return 0;
+	}
+	if (argc != 2) {
+		return BUILTIN_ERROR;
+	}
+
+	for (i = 0; i < 3 && strcmp(argv[1], modes[i]) != 0; ++i);
+	if (i == 3) {
+		return BUILTIN_ERROR;
+	}
+	rw_set_mode(i);
+	lc_clear(); /* cached lines were rewritten in the old mode */
+	return 0;
+}
+
+/* pipesize [default|auto|SIZE] */
+int builtin_pipesize(int argc, char * argv[]) {
+	const char * end;
+	int size;
+
+	if (argc == 1) {
+		size = ps_session();
+		if (size == PS_DEFAULT) {
+			printf("default\n");
+		} else if (size == PS_AUTO) {
+			printf("auto\n");
+		} else {
+			printf("%d\n", size);
+		}
+		fflush(stdout);
+		return 0;
+	}
+	if (argc != 2) {
+		return BUILTIN_ERROR;
+	}
+
+	if (strcmp(argv[1], "default") == 0) {
+		size = PS_DEFAULT;
+	} else if (strcmp(argv[1], "auto") == 0) {
+		size = PS_AUTO;
+	} else if ((size = parsepipesize(argv[1], &end)) == -1 || *end != '\0') {
+		return BUILTIN_ERROR;
+	}
+	ps_set_session(size);
+	return 0;
+}
+
+int load_builtin(const char * library, const char * name) {
+	union {
+		void * ptr;
+		builtin_func func;
+	} symbol;
+	void * handle;
+	char * name_copy;
+
+	handle = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+		fprintf(stderr, "enable: %s\n", dlerror());
+		goto error;
+	}
+
+	symbol.ptr = dlsym(handle, name);
+	if (symbol.ptr == NULL) {
+		fprintf(stderr, "enable: %s: no builtin %s\n", library, name);
+		goto error_handle;
+	}
+
+	name_copy = strdup(name);
+	if (name_copy == NULL) {
+		goto error_handle;
+	}
+	if (_registry_add(name_copy, symbol.func, handle) == -1) {
+		free(name_copy);
+		goto error_handle;
+	}
+	return 0;
+
+error_handle:
+	dlclose(handle);
+error:
+	return -1;
+}
+
+int builtin_enable(int argc, char * argv[]) {
+	int i, result;
+	registry_entry ** e, * next;
+	builtin_pair * shadowed;
+
+	if (!registry_initialized) {
+		_registry_init();
+	}
+
+	if (argc == 1) {
+		for (i = 0; i < REGISTRY_BUCKETS; ++i) {
+			for (next = registry[i]; next != NULL; next = next->next) {
+				printf("enable %s\n", next->name);
+			}
+		}
+		fflush(stdout);
+		return 0;
+	}
+
+	result = 0;
+	if (argc >= 4 && strcmp(argv[1], "-f") == 0) {
+		for (i = 3; i < argc; ++i) {
+			if (load_builtin(argv[2], argv[i]) == -1) {
+				result = 1;
+			}
+		}
+	} else if (argc >= 3 && strcmp(argv[1], "-d") == 0) {
+		for (i = 2; i < argc; ++i) {
+			e = _registry_find(argv[i]);
+			if (*e == NULL || (*e)->handle == NULL) {
+				fprintf(stderr, "enable: %s: not a dynamically loaded builtin\n", argv[i]);
+				result = 1;
+				continue;
+			}
+			next = (*e)->next;
+			_registry_free(*e);
+			*e = next;
+			/* unloading a builtin brings back the static one it replaced */
+			shadowed = _registry_static(argv[i]);
+			if (shadowed != NULL && _registry_add(shadowed->name, shadowed->func, NULL) == -1) {
+				result = 1;
+			}
+		}
+	} else {
+		return BUILTIN_ERROR;
+	}
+	return result;
+}
+
+int builtin_maxjobs(int argc, char * argv[]) {
+	int max;
+
+	if (argc == 1) {
+		printf("%d\n", pg_max_background());
+		fflush(stdout);
+		return 0;
+	}
+	if (argc != 2) {
+		return BUILTIN_ERROR;
+	}
+
+	max = get_int(argv[1]);
+	if (max == -1) {
+		return BUILTIN_ERROR;
+	}
+	pg_set_max_background(max);
+	return 0;
+}
+
+/* Parses "%N" or "N", with no argument it means the most recent job */
+int get_job(int argc, char * argv[]) {
+	if (argc == 1) {
+		return pg_last_background();
+	}
+	if (argc != 2) {
+		return -1;
+	}
+	return get_int(argv[1][0] == '%' ? argv[1] + 1 : argv[1]);
+}
+
+void print_job_status(int pgn, int return_status) {
+	if (WIFEXITED(return_status)) {
+		printf("[%d] Done (exited with status %d)\n", pgn, WEXITSTATUS(return_status));
+	} else if (WIFSIGNALED(return_status)) {
+		printf("[%d] Done (killed by signal %d)\n", pgn, WTERMSIG(return_status));
+	}
+	fflush(stdout);
+}
+
+void print_running_job(int pgn, pid_t pid) {
+	printf("[%d] %d Running\n", pgn, (int) pid);
+}
+
+/* The jobs belong to the shell, a builtin forked as a pipeline stage has
+   none to list, wait for or continue */
+static int in_shell(const char * name) {
+	if (!pg_initialized()) {
+		fprintf(stderr, "%s: not run by the shell itself\n", name);
+		return 0;
+	}
+	return 1;
+}
+
+int builtin_jobs(int argc, char * argv[]) {
+	if (argc != 1) {
+		return BUILTIN_ERROR;
+	}
+	if (!in_shell(argv[0])) {
+		return 1;
+	}
+	pg_foreach_background(print_running_job);
+	fflush(stdout);
+	return 0;
+}
+
+int builtin_fg(int argc, char * argv[]) {
+	int pgn;
+
+	if (!in_shell(argv[0])) {
+		return 1;
+	}
+	pgn = get_job(argc, argv);
+	if (pgn == -1 || !pg_running(pgn)) {
+		fprintf(stderr, "fg: no such job\n");
+		return 1;
+	}
+
+	pg_block_sigchld();
+	pg_set_background(pgn, 0);
+	pg_foreground(pgn);
+	pg_kill(pgn, SIGCONT);
+	pg_wait(pgn);
+	pg_foreground(0);
+	pg_unblock_sigchld();
+	return 0;
+}
+
+int builtin_bg(int argc, char * argv[]) {
+	int pgn;
+
+	if (!in_shell(argv[0])) {
+		return 1;
+	}
+	pgn = get_job(argc, argv);
+	if (pgn == -1 || !pg_running(pgn)) {
+		fprintf(stderr, "bg: no such job\n");
+		return 1;
+	}
+	pg_kill(pgn, SIGCONT);
+	return 0;
+}
+
+int builtin_wait(int argc, char * argv[]) {
+	int i, pgn, return_status, result;
+
+	if (!in_shell(argv[0])) {
+		return 1;
+	}
+	if (argc == 1) {
+		pg_wait_all();
+		return 0;
+	}
+
+	if (argc == 2 && strcmp(argv[1], "-n") == 0) {
+		if (pg_wait_any(&pgn, &return_status) == -1) {
+			return 127;
+		}
+		print_job_status(pgn, return_status);
+		return 0;
+	}
+
+	result = 0;
+	for (i = 1; i < argc; ++i) {
+		pgn = get_int(argv[i][0] == '%' ? argv[i] + 1 : argv[i]);
+		if (pgn == -1 || pg_wait_job(pgn, &return_status) == -1) {
+			fprintf(stderr, "wait: %s: no such job\n", argv[i]);
+			result = 127;
+			continue;
+		}
+		print_job_status(pgn, return_status);
+	}
+	return result;
+}
+
+/* coproc [COMMAND [ARG]...] */
+int builtin_coproc(int argc, char * argv[]) {
+	if (argc == 1) {
+		if (co_pid() == 0) {
+			fprintf(stderr, "coproc: no coprocess\n");
+			return 1;
+		}
+		printf("%d\n", (int) co_pid());
+		fflush(stdout);
+		return 0;
+	}
+	if (co_start(argv + 1) == -1) {
+		fprintf(stderr, "coproc: %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+/* cowrite [WORD]... queues the words and a newline for the coprocess */
+int builtin_cowrite(int argc, char * argv[]) {
+	int i, result;
+
+	if (co_pid() == 0) {
+		fprintf(stderr, "cowrite: no coprocess\n");
+		return 1;
+	}
+	result = 0;
+	for (i = 1; i < argc && result != -1; ++i) {
+		result = co_write(argv[i], strlen(argv[i]));
+		if (result != -1 && i + 1 < argc) {
+			result = co_write(" ", 1);
+		}
+	}
+	if (result == -1 || co_write("\n", 1) == -1) {
+		fprintf(stderr, "cowrite: %s\n", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+/* coread prints the next line of the coprocess, fails at its end */
+int builtin_coread(int argc, char * argv[]) {
+	const char * line;
+	size_t length;
+	int result;
+
+	if (argc != 1) {
+		return BUILTIN_ERROR;
+	}
+	result = co_readline(&line, &length);
+	if (result == -1) {
+		fprintf(stderr, "coread: %s\n", strerror(errno));
+		return 1;
+	}
+	if (result == 0) {
+		return 1;
+	}
+	fwrite(line, 1, length, stdout);
+	putchar('\n');
+	fflush(stdout);
+	return 0;
+}
+
+int builtin_coclose(int argc, char * argv[]) {
+	if (argc != 1) {
+		return BUILTIN_ERROR;
+	}
+	if (co_close_input() == -1) {
+		fprintf(stderr, "coclose: %s\n", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+/* parallel [-j N] [-k] COMMAND [ARG]... [::: ITEM...] */
+int builtin_parallel(int argc, char * argv[]) {
+	char ** template, ** items;
+	int i, start, jobs, keep_order, failed;
+
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0) {
+		jobs = PARALLEL_JOBS;
+	}
+	keep_order = 0;
+	for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+		if (strcmp(argv[i], "-k") == 0) {
+			keep_order = 1;
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && (jobs = get_int(argv[i + 1])) > 0) {
+			++i;
+		} else {
+			return BUILTIN_ERROR;
+		}
+	}
+	if (i == argc) {
+		return BUILTIN_ERROR;
+	}
+
+	/* argv belongs to a cached line, the template is a copy */
+	items = NULL;
+	for (start = i; i < argc; ++i) {
+		if (strcmp(argv[i], ":::") == 0) {
+			items = argv + i + 1;
+			break;
+		}
+	}
+	if (i == start) {
+		return BUILTIN_ERROR;
+	}
+	template = malloc((i - start + 1) * sizeof(char *));
+	if (template == NULL) {
+		return BUILTIN_ERROR;
+	}
+	memcpy(template, argv + start, (i - start) * sizeof(char *));
+	template[i - start] = NULL;
+
+	failed = pj_run(template, items, jobs, keep_order);
+	free(template);
+	if (failed == -1) {
+		fprintf(stderr, "parallel: %s\n", strerror(errno));
+		return 1;
+	}
+	return failed > 0;
+}
+
+/* argbatch [off|on|N] */
+int builtin_argbatch(int argc, char * argv[]) {
+	int jobs;
+
+	if (argc == 1) {
+		if (ab_jobs() == AB_OFF) {
+			printf("off\n");
+		} else {
+			printf("%d\n", ab_jobs());
+		}
+		fflush(stdout);
+		return 0;
+	}
+	if (argc != 2) {
+		return BUILTIN_ERROR;
+	}
+
+	if (strcmp(argv[1], "off") == 0) {
+		jobs = AB_OFF;
+	} else if (strcmp(argv[1], "on") == 0) {
+		jobs = 1;
+	} else if ((jobs = get_int(argv[1])) <= 0) {
+		return BUILTIN_ERROR;
+	}
+	ab_set_jobs(jobs);
+	return 0;
+}
@@ -0,0 +1,340 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "config.h"
+#include "utils.h"
+#include "processgroups.h"
+#include "coprocess.h"
+
+typedef struct co_buffer {
+	char * data;
+	size_t start;     /* first byte not consumed yet */
+	size_t end;
+	size_t capacity;
+} co_buffer;
+
+static pid_t pid = 0;
+static int to_fd = -1;      /* the shell's end of the coprocess's stdin */
+static int from_fd = -1;    /* and of its stdout */
+static co_buffer output = { NULL, 0, 0, 0 };  /* queued for the coprocess */
+static co_buffer input = { NULL, 0, 0, 0 };   /* read from it */
+static co_start_func start_job = NULL;
+static void (*reaped)(pid_t pid, int return_status) = NULL;
+
+/* Wakes up _co_poll on SIGINT, the shell's own handler does nothing */
+static int wake_pipe[2] = {-1, -1};
+static volatile sig_atomic_t interrupted = 0;
+
+void co_set_start(co_start_func start, void (*f)(pid_t pid, int return_status)) {
+	start_job = start;
+	reaped = f;
+}
+
+/* Makes room for length more bytes after the end, moving the unconsumed
+   bytes to the front first */
+static int _co_reserve(co_buffer * b, size_t length) {
+	size_t capacity;
+	char * data;
+
+	if (b->start > 0) {
+		b->end -= b->start;
+		memmove(b->data, b->data + b->start, b->end);
+		b->start = 0;
+	}
+	if (b->end + length <= b->capacity) {
+		return 0;
+	}
+	capacity = b->capacity ? b->capacity : COPROC_BUFFER_SIZE;
+	for (; capacity < b->end + length; capacity *= 2);
+	data = realloc(b->data, capacity);
+	if (data == NULL) {
+		return -1;
+	}
+	b->data = data;
+	b->capacity = capacity;
+	return 0;
+}
+
+static void _co_close_fd(int * fd) {
+	int result;
+
+	if (*fd != -1) {
+		EINTR_RETRY(result, close(*fd));
+		*fd = -1;
+	}
+}
+
+static void _co_close() {
+	_co_close_fd(&to_fd);
+	_co_close_fd(&from_fd);
+	_co_close_fd(&wake_pipe[0]);
+	_co_close_fd(&wake_pipe[1]);
+	output.start = output.end = 0;
+	input.start = input.end = 0;
+	pid = 0;
+}
+
+/* Writes queued bytes until the pipe is full. Returns -1 if the coprocess's
+   stdin is closed, the queue is dropped then. */
+static int _co_drain() {
+	ssize_t result;
+
+	while (output.start < output.end) {
+		EINTR_RETRY(result, write(to_fd, output.data + output.start, output.end - output.start));
+		if (result == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			output.start = output.end = 0;
+			return -1;
+		}
+		output.start += result;
+	}
+	output.start = output.end = 0;
+	return 0;
+}
+
+/* Reads what the coprocess wrote so far. Returns -1 on error, its stdout is
+   closed at the end. */
+static int _co_fill() {
+	ssize_t result;
+
+	for (;;) {
+		if (_co_reserve(&input, COPROC_BUFFER_SIZE) == -1) {
+			return -1;
+		}
+		EINTR_RETRY(result, read(from_fd, input.data + input.end, input.capacity - input.end));
+		if (result == -1) {
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		if (result == 0) {
+			_co_close_fd(&from_fd);
+			return 0;
+		}
+		input.end += result;
+	}
+}
+
+static void _co_sigint(int signo) {
+	int saved_errno, result;
+
+	interrupted = 1;
+	saved_errno = errno;
+	result = write(wake_pipe[1], "", 1); /* a full pipe wakes up as well */
+	(void) result;
+	errno = saved_errno;
+}
+
+/* Blocks until the coprocess takes queued bytes or writes some, and handles
+   both, so neither side can wait for the other forever. Fails with EINTR on
+   SIGINT. */
+static int _co_poll() {
+	struct pollfd fds[3];
+	struct sigaction sa, old_sa;
+	char drain[64];
+	int n, result;
+
+	n = 0;
+	if (from_fd != -1) {
+		fds[n].fd = from_fd;
+		fds[n].events = POLLIN;
+		++n;
+	}
+	if (to_fd != -1 && output.start < output.end) {
+		fds[n].fd = to_fd;
+		fds[n].events = POLLOUT;
+		++n;
+	}
+	if (n == 0) {
+		return 0;
+	}
+	fds[n].fd = wake_pipe[0];
+	fds[n].events = POLLIN;
+
+	interrupted = 0;
+	sa.sa_handler = _co_sigint;
+	sa.sa_flags = 0;
+	if (sigemptyset(&sa.sa_mask) == -1 || sigaction(SIGINT, &sa, &old_sa) == -1) {
+		return -1;
+	}
+	do {
+		result = poll(fds, n + 1, -1);
+	} while (result == -1 && errno == EINTR && !interrupted);
+	sigaction(SIGINT, &old_sa, NULL); /* ignore errors */
+	if (fds[n].revents) {
+		while (read(wake_pipe[0], drain, sizeof(drain)) > 0);
+	}
+	if (interrupted) {
+		errno = EINTR;
+		return -1;
+	}
+	if (result == -1) {
+		return -1;
+	}
+	while (n-- > 0) {
+		if (fds[n].revents == 0) {
+			continue;
+		}
+		if (fds[n].fd == to_fd) {
+			result = _co_drain();
+		} else {
+			result = _co_fill();
+		}
+		if (result == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Returns a close-on-exec non-blocking pipe, ours being the end the
+   coprocess doesn't get */
+static int _co_pipe(int p[2], int ours) {
+	if (pipe(p) == -1) {
+		return -1;
+	}
+	if (fcntl(p[0], F_SETFD, FD_CLOEXEC) == -1
+	  || fcntl(p[1], F_SETFD, FD_CLOEXEC) == -1
+	  || fcntl(p[ours], F_SETFL, O_NONBLOCK) == -1) {
+		close(p[0]);
+		close(p[1]);
+		return -1;
+	}
+	return 0;
+}
+
+pid_t co_start(char * argv[]) {
+	int to[2], from[2], shell_fds[2], pgn;
+	pid_t child_pid;
+
+	if (start_job == NULL) {
+		errno = ENOSYS;
+		return -1;
+	}
+	_co_close();
+	if (_co_pipe(to, 1) == -1) {
+		return -1;
+	}
+	if (_co_pipe(from, 0) == -1) {
+		goto error_to;
+	}
+	if (_co_pipe(wake_pipe, 0) == -1) {
+		wake_pipe[0] = wake_pipe[1] = -1;
+		goto error_from;
+	}
+	if (fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK) == -1) {
+		goto error_wake;
+	}
+
+	pg_block_sigchld();
+	pgn = pg_new(NULL);
+	if (pgn == -1) {
+		goto error;
+	}
+	pg_set_background(pgn, 1);
+
+	/* a forked builtin closes the shell's ends, or it would never see EOF */
+	shell_fds[0] = to[1];
+	shell_fds[1] = from[0];
+	child_pid = start_job(argv, to[0], from[1], 0, shell_fds, 2);
+	if (child_pid == -1 || pg_add_process(pgn, child_pid, reaped) == -1) {
+		pg_del(pgn);
+		goto error;
+	}
+	pg_unblock_sigchld();
+
+	close(to[0]);
+	close(from[1]);
+	to_fd = to[1];
+	from_fd = from[0];
+	pid = child_pid;
+	return pid;
+
+error:
+	pg_unblock_sigchld();
+error_wake:
+	_co_close_fd(&wake_pipe[0]);
+	_co_close_fd(&wake_pipe[1]);
+error_from:
+	close(from[0]);
+	close(from[1]);
+error_to:
+	close(to[0]);
+	close(to[1]);
+	return -1;
+}
+
+pid_t co_pid() {
+	return pid;
+}
+
+int co_write(const char * data, size_t length) {
+	if (to_fd == -1) {
+		errno = EPIPE;
+		return -1;
+	}
+	if (_co_reserve(&output, length) == -1) {
+		return -1;
+	}
+	memcpy(output.data + output.end, data, length);
+	output.end += length;
+	return _co_drain();
+}
+
+int co_readline(const char ** line, size_t * length) {
+	char * newline;
+
+	for (;;) {
+		newline = input.start < input.end
+		  ? memchr(input.data + input.start, '\n', input.end - input.start) : NULL;
+		if (newline != NULL) {
+			*line = input.data + input.start;
+			*length = newline - *line;
+			input.start += *length + 1;
+			return 1;
+		}
+		if (from_fd == -1) {
+			break;
+		}
+		if (_co_poll() == -1) {
+			return -1;
+		}
+	}
+
+	/* the end of the coprocess's output, a last line may have no newline */
+	*line = input.data + input.start;
+	*length = input.end - input.start;
+	input.start = input.end = 0;
+	if (to_fd == -1) {
+		_co_close();
+	}
+	return *length > 0;
+}
+
+int co_close_input() {
+	int result;
+
+	result = 0;
+	while (to_fd != -1 && output.start < output.end && result != -1) {
+		result = _co_poll();
+	}
+	_co_close_fd(&to_fd);
+	output.start = output.end = 0;
+	if (from_fd == -1 && input.start == input.end) {
+		_co_close();
+	}
+	return result;
+}
+
+void co_close_fds() {
+	_co_close();
+}
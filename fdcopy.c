@@ -0,0 +1,279 @@
+#define _GNU_SOURCE /* splice, tee and copy_file_range */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "utils.h"
+#include "fdcopy.h"
+
+#if USE_ZERO_COPY && defined(__linux__)
+#define HAVE_ZERO_COPY 1
+#include <sys/sendfile.h>
+#endif
+
+#define FC_LARGE_CHUNK (1 << 30) /* per call limit of the file to file copies */
+
+enum { FC_RANGE, FC_SENDFILE, FC_SPLICE, FC_RW };
+
+static char buffer[COPY_CHUNK_SIZE];
+
+static int _fc_write_all(int fd, const char * data, size_t len) {
+	ssize_t result;
+
+	while (len > 0) {
+		EINTR_RETRY(result, write(fd, data, len));
+		if (result == -1) {
+			return -1;
+		}
+		data += result;
+		len -= result;
+	}
+	return 0;
+}
+
+/* Reads at most len bytes from in and writes all of them to out */
+static ssize_t _fc_read_write(int in, int out, size_t len) {
+	ssize_t result;
+
+	if (len > sizeof(buffer)) {
+		len = sizeof(buffer);
+	}
+	EINTR_RETRY(result, read(in, buffer, len));
+	if (result > 0 && _fc_write_all(out, buffer, result) == -1) {
+		return -1;
+	}
+	return result;
+}
+
+static int _fc_tee_read_write(int in, const int * outs, int n) {
+	ssize_t result;
+	int i;
+
+	for (;;) {
+		EINTR_RETRY(result, read(in, buffer, sizeof(buffer)));
+		if (result <= 0) {
+			return result;
+		}
+		for (i = 0; i < n; ++i) {
+			if (_fc_write_all(outs[i], buffer, result) == -1) {
+				return -1;
+			}
+		}
+	}
+}
+
+#ifdef HAVE_ZERO_COPY
+
+static int _fc_is_pipe(int fd) {
+	struct stat st;
+	return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+/* Errors meaning the kernel can't move data between these descriptors this
+   way, e.g. an old kernel, files on different file systems or an output
+   opened with O_APPEND */
+static int _fc_unsupported(int error) {
+	return error == EINVAL || error == ENOSYS || error == EXDEV
+	  || error == EBADF || error == EOPNOTSUPP;
+}
+
+static int _fc_method(int in, int out) {
+	struct stat in_st, out_st;
+
+	if (fstat(in, &in_st) == -1 || fstat(out, &out_st) == -1) {
+		return FC_RW;
+	}
+	if (S_ISFIFO(in_st.st_mode)) {
+		return FC_SPLICE;
+	}
+	/* files in /proc and /sys report size 0, the kernel copies nothing; a
+	   splice from a terminal waits for a whole pipe buffer, not a line */
+	if (!S_ISREG(in_st.st_mode) || in_st.st_size == 0) {
+		return FC_RW;
+	}
+	if (S_ISFIFO(out_st.st_mode)) {
+		return FC_SPLICE;
+	}
+	return S_ISREG(out_st.st_mode) ? FC_RANGE : FC_SENDFILE;
+}
+
+static ssize_t _fc_step(int method, int in, int out) {
+	switch (method) {
+	case FC_RANGE:
+		return copy_file_range(in, NULL, out, NULL, FC_LARGE_CHUNK, 0);
+	case FC_SENDFILE:
+		return sendfile(out, in, NULL, FC_LARGE_CHUNK);
+	case FC_SPLICE:
+		return splice(in, NULL, out, NULL, COPY_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+	}
+	return _fc_read_write(in, out, sizeof(buffer));
+}
+
+int fc_copy(int in, int out) {
+	int method;
+	ssize_t result;
+
+	method = _fc_method(in, out);
+	for (;;) {
+		EINTR_RETRY(result, _fc_step(method, in, out));
+		if (result == 0) {
+			return 0;
+		}
+		if (result == -1) {
+			if (method == FC_RW || !_fc_unsupported(errno)) {
+				return -1;
+			}
+			/* both file to file copies can still use sendfile */
+			method = method == FC_RANGE ? FC_SENDFILE : FC_RW;
+		}
+	}
+}
+
+/* Moves exactly len bytes, already waiting in the pipe in, to out */
+static int _fc_splice_all(int in, int out, size_t len) {
+	ssize_t result;
+	int use_splice;
+
+	use_splice = 1;
+	while (len > 0) {
+		if (use_splice) {
+			EINTR_RETRY(result, splice(in, NULL, out, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE));
+			if (result == -1 && _fc_unsupported(errno)) {
+				use_splice = 0;
+				continue;
+			}
+		} else {
+			result = _fc_read_write(in, out, len);
+		}
+		if (result <= 0) {
+			return -1;
+		}
+		len -= result;
+	}
+	return 0;
+}
+
+/* tee duplicated only got bytes of the chunk to outs[0], the outputs before it
+   have the whole chunk and the ones after it nothing. The chunk is still in
+   the pipe in, read it and write the missing parts. */
+static int _fc_tee_finish_chunk(int in, const int * outs, int n, size_t chunk, size_t got) {
+	ssize_t result;
+	size_t have;
+	int i;
+
+	for (have = 0; have < chunk; have += result) {
+		EINTR_RETRY(result, read(in, buffer + have, chunk - have));
+		if (result <= 0) {
+			return -1;
+		}
+	}
+	if (_fc_write_all(outs[0], buffer + got, chunk - got) == -1) {
+		return -1;
+	}
+	for (i = 1; i < n; ++i) {
+		if (_fc_write_all(outs[i], buffer, chunk) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int fc_tee(int in, const int * outs, int n) {
+	int * out_is_pipe, scratch[2], i, result;
+	ssize_t duplicated;
+	size_t chunk;
+	int in_size;
+
+	if (n == 1) {
+		return fc_copy(in, outs[0]);
+	}
+	if (n == 0 || !_fc_is_pipe(in)) {
+		return _fc_tee_read_write(in, outs, n);
+	}
+
+	out_is_pipe = malloc(n * sizeof(int));
+	if (out_is_pipe == NULL) {
+		return -1;
+	}
+	for (i = 0; i < n; ++i) {
+		out_is_pipe[i] = _fc_is_pipe(outs[i]);
+	}
+	/* outputs that aren't pipes get their copy through this pipe, as large
+	   as in so a whole chunk of in fits */
+	if (pipe(scratch) == -1) {
+		free(out_is_pipe);
+		return -1;
+	}
+	in_size = fcntl(in, F_GETPIPE_SZ);
+	if (in_size > 0) {
+		fcntl(scratch[1], F_SETPIPE_SZ, in_size);
+	}
+
+	result = 0;
+	for (;;) {
+		/* every output but the last gets a duplicate of the chunk, the last
+		   one consumes it */
+		chunk = 0;
+		for (i = 0; i < n - 1; ++i) {
+			EINTR_RETRY(duplicated, tee(in, out_is_pipe[i] ? outs[i] : scratch[1],
+			  chunk > 0 ? chunk : COPY_CHUNK_SIZE, 0));
+			if (duplicated == -1) {
+				if (i == 0 && _fc_unsupported(errno)) {
+					result = _fc_tee_read_write(in, outs, n);
+				} else {
+					result = -1;
+				}
+				goto out;
+			}
+			if (chunk == 0) {
+				if (duplicated == 0) {
+					goto out; /* end of file */
+				}
+				chunk = duplicated;
+			}
+			if (!out_is_pipe[i] && _fc_splice_all(scratch[0], outs[i], duplicated) == -1) {
+				result = -1;
+				goto out;
+			}
+			if ((size_t) duplicated < chunk) {
+				if (_fc_tee_finish_chunk(in, outs + i, n - i, chunk, duplicated) == -1) {
+					result = -1;
+					goto out;
+				}
+				break;
+			}
+		}
+		if (i == n - 1 && _fc_splice_all(in, outs[n - 1], chunk) == -1) {
+			result = -1;
+			goto out;
+		}
+	}
+
+out:
+	close(scratch[0]);
+	close(scratch[1]);
+	free(out_is_pipe);
+	return result;
+}
+
+#else /* !HAVE_ZERO_COPY */
+
+int fc_copy(int in, int out) {
+	ssize_t result;
+
+	do {
+		result = _fc_read_write(in, out, sizeof(buffer));
+	} while (result > 0);
+	return result;
+}
+
+int fc_tee(int in, const int * outs, int n) {
+	return _fc_tee_read_write(in, outs, n);
+}
+
+#endif /* HAVE_ZERO_COPY */
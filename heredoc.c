@@ -0,0 +1,190 @@
+#define _GNU_SOURCE /* memfd_create and file seals */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "config.h"
+#include "utils.h"
+#include "siparse.h"
+#include "heredoc.h"
+
+#if USE_MEMFD && defined(__linux__) && defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+#define HAVE_MEMFD 1
+#define HD_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+#else
+#define HD_SEALS 0
+#endif
+
+typedef struct hd_body {
+	const char * word;  /* of the redirection, shared by its copies */
+	line * owner;
+	int fd;
+} hd_body;
+
+/* Bodies of the opened lines */
+static hd_body * bodies = NULL;
+static int bodies_count = 0;
+static int bodies_capacity = 0;
+
+static int _hd_write_all(int fd, const char * data, size_t length) {
+	ssize_t result;
+
+	for (; length > 0; data += result, length -= result) {
+		EINTR_RETRY(result, write(fd, data, length));
+		if (result == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Writes the body and optionally a newline into a pipe, which can hold it
+   without blocking, and returns the read end */
+static int _hd_pipe(const char * body, size_t length, int newline) {
+	int p[2], result;
+
+	if (pipe(p) == -1) {
+		return -1;
+	}
+	result = fcntl(p[0], F_SETFD, FD_CLOEXEC) == -1
+	  || _hd_write_all(p[1], body, length) == -1
+	  || (newline && _hd_write_all(p[1], "\n", 1) == -1);
+	close(p[1]);
+	if (result) {
+		close(p[0]);
+		return -1;
+	}
+	return p[0];
+}
+
+/* Returns a close-on-exec descriptor of a file with no name to write a body
+   to, and whether seals can be added to it */
+static int _hd_file(int * sealable) {
+	FILE * file;
+	int fd;
+
+#ifdef HAVE_MEMFD
+	fd = memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd != -1) {
+		*sealable = 1;
+		return fd;
+	}
+#endif
+	*sealable = 0;
+	file = tmpfile();
+	if (file == NULL) {
+		return -1;
+	}
+	fd = fcntl(fileno(file), F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+	fclose(file);
+	return fd;
+}
+
+/* Writes the body into a file, sealed against any further change, and
+   returns it positioned at the start */
+static int _hd_sealed_file(const char * body, size_t length, int newline) {
+	int fd, sealable;
+
+	fd = _hd_file(&sealable);
+	if (fd == -1) {
+		return -1;
+	}
+	if (_hd_write_all(fd, body, length) == -1
+	  || (newline && _hd_write_all(fd, "\n", 1) == -1)
+	  || (sealable && fcntl(fd, F_ADD_SEALS, HD_SEALS) == -1)
+	  || lseek(fd, 0, SEEK_SET) == (off_t) -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int _hd_add(redirection * redir, line * owner, const char * body, size_t length, int newline) {
+	hd_body * tmp;
+	int capacity, fd;
+
+	if (bodies_count == bodies_capacity) {
+		capacity = bodies_capacity ? 2 * bodies_capacity : 8;
+		tmp = realloc(bodies, capacity * sizeof(hd_body));
+		if (tmp == NULL) {
+			return -1;
+		}
+		bodies = tmp;
+		bodies_capacity = capacity;
+	}
+	if (length + newline <= HEREDOC_PIPE_MAX && length + newline <= PIPE_BUF) {
+		fd = _hd_pipe(body, length, newline);
+	} else {
+		fd = _hd_sealed_file(body, length, newline);
+	}
+	if (fd == -1) {
+		return -1;
+	}
+	bodies[bodies_count].word = redir->filename;
+	bodies[bodies_count].owner = owner;
+	bodies[bodies_count].fd = fd;
+	++bodies_count;
+	return 0;
+}
+
+int hd_open(line * ln, const char * heredocs, size_t length) {
+	pipeline * pl;
+	command ** com;
+	redirection ** redir;
+	size_t body_length;
+	int result;
+
+	for (pl = ln->pipelines; *pl != NULL; ++pl) {
+		for (com = *pl; *com != NULL; ++com) {
+			for (redir = (*com)->redirs; *redir != NULL; ++redir) {
+				if (IS_RHEREDOC((*redir)->flags)) {
+					body_length = length > 0 ? strlen(heredocs) : 0;
+					result = _hd_add(*redir, ln, heredocs, body_length, 0);
+					if (length > 0) {
+						heredocs += body_length + 1;
+						length -= body_length + 1;
+					}
+				} else if (IS_RHERESTR((*redir)->flags)) {
+					result = _hd_add(*redir, ln, (*redir)->filename, strlen((*redir)->filename), 1);
+				} else {
+					continue;
+				}
+				if (result == -1) {
+					hd_close(ln);
+					return -1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+int hd_fd(redirection * redir) {
+	int i;
+
+	for (i = 0; i < bodies_count; ++i) {
+		if (bodies[i].word == redir->filename) {
+			return bodies[i].fd;
+		}
+	}
+	return -1;
+}
+
+void hd_close(line * ln) {
+	int i, result;
+
+	for (i = 0; i < bodies_count; ) {
+		if (bodies[i].owner == ln) {
+			EINTR_RETRY(result, close(bodies[i].fd));
+			bodies[i] = bodies[--bodies_count];
+		} else {
+			++i;
+		}
+	}
+}
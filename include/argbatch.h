@@ -0,0 +1,29 @@
+#ifndef _ARGBATCH_H_
+#define _ARGBATCH_H_
+
+/* Batching of argument vectors too large for exec (E2BIG), like xargs: the
+   command name and its leading options, words starting with '-' up to and
+   including a "--", go into every batch, and the remaining arguments are
+   split into the largest batches that fit the limit. A command whose
+   operands come before its files, like "grep PATTERN FILE...", has to mark
+   them as options ("grep -e PATTERN FILE..."). */
+
+/* Session setting of the argbatch builtin: AB_OFF leaves exec to fail,
+   otherwise the number of batches run at once */
+#define AB_OFF 0
+
+void ab_set_jobs(int jobs);
+int ab_jobs();
+
+/* Whether argv has to be split, i.e. batching is on and it doesn't fit
+   sysconf(_SC_ARG_MAX) minus the environment */
+int ab_needed(char ** argv);
+
+/* Runs the batches of argv, with path as found by pc_lookup, as children of
+   the calling process, so in its process group. Meant for a forked child
+   that would exec argv. Returns 0 if all succeeded, otherwise the exit
+   status of the first failed batch in argv order, whatever order they end in,
+   128 + signal if killed. */
+int ab_run(char ** argv, const char * path);
+
+#endif /* !_ARGBATCH_H_ */
@@ -12,6 +12,12 @@ typedef struct {
 
 extern builtin_pair builtins_table[];
 
+/* Finds a builtin by name, either one from builtins_table or one loaded at
+   runtime with "enable -f library name", which looks up symbol name of type
+   builtin_func in the shared library. */
 builtin_func get_builtin(const char *name);
 
+/* Unloads all runtime loaded builtins */
+void builtins_clean();
+
 #endif /* !_BUILTINS_H_ */
@@ -1,7 +1,8 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
-#define MAX_LINE_LENGTH 2048
+/* Initial size of the line buffer, it grows to fit lines of any length */
+#define LINE_BUFFER_SIZE 4096
 
 #define SYNTAX_ERROR_STR "Syntax error."
 
@@ -9,4 +10,91 @@
 
 #define PROMPT_STR "$ "
 
+/* Prompt for the body lines of a here-document */
+#define CONTINUATION_PROMPT_STR "> "
+
+/* Launch external commands with posix_spawn when the system supports it,
+   falling back to fork for everything it can't express */
+#define USE_POSIX_SPAWN 1
+
+/* Number of parsed command lines kept for reuse, lines longer than
+   LINE_CACHE_MAX_LENGTH are always parsed again */
+#define LINE_CACHE_SIZE 64
+#define LINE_CACHE_MAX_LENGTH 4096
+
+/* Initial mode of the pipeline rewriting pass (see rewrite.h), the rewrite
+   builtin changes it: 0 off, 1 on, 2 dry run */
+#define REWRITE_PIPELINES 1
+
+/* Let the lcat and ltee builtins move data inside the kernel with
+   copy_file_range, sendfile, splice and tee on Linux, and the number of
+   bytes they move through a pipe or a buffer at a time */
+#define USE_ZERO_COPY 1
+#define COPY_CHUNK_SIZE 65536
+
+/* Largest pipe capacity accepted by |[SIZE] and the pipesize builtin, the
+   kernel's limit in /proc/sys/fs/pipe-max-size applies on top of it. With
+   "pipesize auto" the pipes of a foreground pipeline are checked every
+   PIPE_ADAPT_INTERVAL_MS and the full ones doubled. */
+#define MAX_PIPE_SIZE (1 << 30)
+#define PIPE_ADAPT_INTERVAL_MS 10
+
+/* Directory naming open file descriptors, process substitutions are
+   replaced by the name of a pipe end in it */
+#define PROCESS_SUBSTITUTION_DIR "/dev/fd/"
+
+/* Here-document and here-string bodies of up to HEREDOC_PIPE_MAX bytes, and
+   PIPE_BUF so writing them never blocks, are put in a pipe, larger ones in a
+   sealed memfd_create file on Linux or an unlinked temporary file elsewhere */
+#define USE_MEMFD 1
+#define HEREDOC_PIPE_MAX 4096
+
+/* Initial size of the buffers of the coproc builtins, queued requests and
+   unread responses grow them as needed */
+#define COPROC_BUFFER_SIZE 65536
+
+/* Initial size of the buffer collecting the output of a job of the parallel
+   builtin, and the default number of its jobs running at once when the
+   number of processors is unknown */
+#define PARALLEL_BUFFER_SIZE 16384
+#define PARALLEL_JOBS 4
+
+/* Initial setting of the argbatch builtin: 0 lets an exec whose arguments
+   don't fit sysconf(_SC_ARG_MAX) fail with E2BIG, N runs the command in
+   batches of arguments that fit, N batches at a time. ARG_BATCH_HEADROOM
+   bytes of the limit are left unused, ARG_BATCH_FALLBACK_MAX is the limit
+   when the system doesn't tell it. */
+#define ARG_BATCH_JOBS 0
+#define ARG_BATCH_HEADROOM 2048
+#define ARG_BATCH_FALLBACK_MAX 131072
+
+/* Seconds after which a "command not found" entry in the PATH cache expires */
+#define PATH_CACHE_NEGATIVE_TTL 5
+
+/* Receive SIGCHLD through signalfd on Linux and reap children in normal
+   context instead of in the signal handler */
+#define USE_SIGNALFD 1
+
+/* Number of finished background processes remembered between prompts, the
+   rest is only counted */
+#define DEAD_CHILDREN_RING_SIZE 1024
+
+/* Environment variable with the initial limit of concurrently running
+   background jobs, the maxjobs builtin changes it later */
+#define MAX_JOBS_ENV "MSHELL_MAX_JOBS"
+
+/* Number of finished background jobs whose status is kept for wait */
+#define FINISHED_JOBS_SIZE 256
+
+/* fork failing with EAGAIN is retried this many times, waiting
+   FORK_RETRY_DELAY_MS before the first retry and twice as long each time */
+#define FORK_RETRY_COUNT 10
+#define FORK_RETRY_DELAY_MS 1
+
+/* Environment variable with the name of a file to write a Chrome trace of
+   the shell's work to, and the number of reaped children the trace can hold
+   between two other events */
+#define TRACE_ENV "MSHELL_TRACE"
+#define TRACE_EXIT_RING_SIZE 1024
+
 #endif /* !_CONFIG_H_ */
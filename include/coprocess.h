@@ -0,0 +1,48 @@
+#ifndef _COPROCESS_H_
+#define _COPROCESS_H_
+
+#include <sys/types.h>
+#include <stddef.h>
+
+/* A coprocess is a long-lived background job connected to the shell by two
+   pipes, one to its stdin and one from its stdout, so many requests can be
+   exchanged with it without starting it again. The shell's ends are
+   non-blocking and buffered: writes never block, and reads wait for a whole
+   line while still feeding the coprocess what is buffered for it. */
+
+/* Starts argv with in_fd and out_fd as its stdin and stdout in the process
+   group pg_pid, 0 for a new one. A forked builtin closes the count pipe
+   ends in shell_fds. Returns its pid or -1. */
+typedef pid_t (*co_start_func)(char ** argv, int in_fd, int out_fd, pid_t pg_pid,
+    int * shell_fds, int count);
+
+/* Sets how the coprocess is started, the shell starts it like a pipeline
+   stage, and the pg_add_process callback told when it terminates */
+void co_set_start(co_start_func start, void (*f)(pid_t pid, int return_status));
+
+/* Starts argv as the coprocess in a new background group, closing the pipes
+   of a previous one. Returns its pid or -1. */
+pid_t co_start(char * argv[]);
+
+/* pid of the coprocess, 0 if there is none */
+pid_t co_pid();
+
+/* Queues length bytes for the coprocess and writes as much as it takes
+   without blocking. Returns -1 if its stdin is closed. */
+int co_write(const char * data, size_t length);
+
+/* Waits for the next line the coprocess writes and returns it without the
+   newline, valid until the next call. Returns 1 for a line, 0 when its
+   stdout is at the end and -1 on error, with EINTR on SIGINT. */
+int co_readline(const char ** line, size_t * length);
+
+/* Writes everything queued and closes the coprocess's stdin, so it sees the
+   end of its input. Its output can still be read. Returns -1 on error,
+   with EINTR on SIGINT. */
+int co_close_input();
+
+/* Closes the shell's ends in a forked child, where the coprocess builtins
+   then see no coprocess. The coprocess itself is left running. */
+void co_close_fds();
+
+#endif /* !_COPROCESS_H_ */
@@ -0,0 +1,16 @@
+#ifndef _FDCOPY_H_
+#define _FDCOPY_H_
+
+/* Copies everything from in to out until end of file, moving the data inside
+   the kernel when the types of the descriptors allow it: copy_file_range
+   between regular files, splice when one side is a pipe and sendfile from
+   regular files. Anything else falls back to read and write. Returns -1 with
+   errno set on error. */
+int fc_copy(int in, int out);
+
+/* Copies everything from in to each of the n descriptors in outs. When in is
+   a pipe the data is duplicated with tee and moved with splice, otherwise it
+   goes through a buffer. Returns -1 with errno set on error. */
+int fc_tee(int in, const int * outs, int n);
+
+#endif /* !_FDCOPY_H_ */
@@ -0,0 +1,24 @@
+#ifndef _HEREDOC_H_
+#define _HEREDOC_H_
+
+#include <stddef.h>
+
+#include "siparse.h"
+
+/* Here-documents and here-strings: each <<WORD or <<<WORD redirection of a
+   line gets a descriptor its command reads the body from as stdin. */
+
+/* Opens the bodies of the redirections of ln. Here-documents take theirs in
+   order from heredocs, length bytes of bodies each followed by a null as
+   lr_readline collects them, and get an empty one when it runs out. A
+   here-string's body is its word and a newline. Returns -1 on failure. */
+int hd_open(line * ln, const char * heredocs, size_t length);
+
+/* Descriptor of the body of a redirection of an opened line, or of a copy
+   of one, -1 if none */
+int hd_fd(redirection * redir);
+
+/* Closes the descriptors of ln */
+void hd_close(line * ln);
+
+#endif /* !_HEREDOC_H_ */
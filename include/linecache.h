@@ -0,0 +1,31 @@
+#ifndef _LINECACHE_H_
+#define _LINECACHE_H_
+
+#include "siparse.h"
+
+/* Cache of parsed command lines keyed by their text, least recently used
+   lines are dropped first. An entry is taken out of the cache while its line
+   runs and put back afterwards, so clearing the cache from a builtin never
+   frees the line being executed. */
+typedef struct lc_entry lc_entry;
+
+/* Removes the entry for text from the cache and returns it, NULL on a miss */
+lc_entry * lc_take(const char * text);
+
+/* Creates an entry for text owning ln, a line from parselineowned. Returns
+   NULL if out of memory. */
+lc_entry * lc_new(const char * text, line * ln);
+
+line * lc_line(lc_entry * entry);
+
+/* Returns the entry to the cache as the most recently used one, evicting the
+   least recently used line when full. Entries for lines too long to cache
+   are freed. */
+void lc_put(lc_entry * entry);
+
+/* Frees every cached line and resets the counters */
+void lc_clear();
+
+void lc_stats(long * hits, long * misses, int * entries);
+
+#endif /* !_LINECACHE_H_ */
@@ -2,16 +2,33 @@
 #define _LINEREADER_H_
 
 #include <stdio.h>
+#include <stddef.h>
 
 struct linereader
 {
 	char * buffor;
+	size_t capacity;
+	size_t start;              /* start of the next line in buffor */
+	size_t end;                /* end of the data read so far */
+	size_t scanned;            /* bytes after start known to have no newline */
 	int print_prompt;
-	int offset;
-	int last_line_length;
+	int (*wait_input)(int fd); /* called before blocking in read, may be NULL */
+	char * map;                /* stdin mapped when it is a regular file */
+	size_t map_size;
+	size_t map_offset;         /* start of the next line in map */
+	char * docs;               /* copy of a line with here-documents, then
+	                              their bodies */
+	size_t docs_capacity;
+	const char * heredocs;     /* bodies of the here-documents of the last
+	                              line, each followed by a null, or NULL */
+	size_t heredocs_length;
 };
 
 int lr_init(struct linereader *);
+/* Reads the next line, NULL at the end of input. When the line has
+   here-documents (<<WORD), the lines up to each WORD line are read too and
+   left in heredocs. A script on stdin is mapped and the file offset left at
+   its end, so commands run by the script reading stdin get EOF. */
 int lr_readline(struct linereader *, char const** result);
 void lr_clean(struct linereader *);
 
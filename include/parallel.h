@@ -0,0 +1,24 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <sys/types.h>
+
+/* Starts argv with in_fd and out_fd as its stdin and stdout in the process
+   group pg_pid, 0 for a new one. Returns its pid or -1. */
+typedef pid_t (*pj_start_func)(char ** argv, int in_fd, int out_fd, pid_t pg_pid);
+
+/* Sets how jobs are started, the shell starts them like pipeline stages */
+void pj_set_start(pj_start_func start);
+
+/* Runs the command template once for every item, the items of the NULL
+   ended array or else the lines of stdin, with at most jobs of them running
+   at a time, each in its own process group. Every {} in the template is
+   replaced by the item, without any the item is added as the last argument.
+   The stdout of every job is collected and written at once when the job
+   ends, in the order of the items with keep_order. The jobs read /dev/null
+   unless stdin is redirected and holds no items, and SIGINT is passed on to
+   them, after which no more are started. Returns the number of failed jobs
+   or -1 on error. */
+int pj_run(char ** template, char ** items, int jobs, int keep_order);
+
+#endif /* !_PARALLEL_H_ */
@@ -0,0 +1,21 @@
+#ifndef _PATHCACHE_H_
+#define _PATHCACHE_H_
+
+/* Resolves a command name through PATH the way execvp would, remembering the
+   result. Returns the absolute path of the command, NULL if it was not found
+   or the name itself if the result can't be cached (name contains a slash or
+   PATH has relative entries), in which case the caller should use execvp.
+   A found path is not checked again on later lookups: when executing it
+   fails with ENOENT or EACCES the caller drops it with pc_forget. */
+const char * pc_lookup(const char * name);
+
+/* Drops the entry of name, if any */
+void pc_forget(const char * name);
+
+/* Drops every cached entry */
+void pc_clear();
+
+/* Calls f for every cached entry, path is NULL for commands not found */
+void pc_foreach(void (*f)(const char * name, const char * path, int hits));
+
+#endif /* !_PATHCACHE_H_ */
@@ -0,0 +1,43 @@
+#ifndef _PIPESIZE_H_
+#define _PIPESIZE_H_
+
+#include <sys/types.h>
+
+/* Session setting of the pipesize builtin: PS_DEFAULT leaves pipes as the
+   system creates them, PS_AUTO grows the pipes of foreground pipelines found
+   full while the shell waits for them, any other value is a capacity in
+   bytes. |[SIZE] in a pipeline overrides it for one pipe. */
+#define PS_DEFAULT 0
+#define PS_AUTO (-1)
+
+void ps_set_session(int size);
+int ps_session();
+
+/* Largest capacity an unprivileged process can give a pipe, 0 when pipes
+   can't be resized */
+int ps_max_size();
+
+/* Sets the capacity of the pipe fd to size, or to the session setting when
+   size is 0, limited to what the system allows. Returns -1 on failure, the
+   pipe keeps working with its current capacity then. */
+int ps_apply(int fd, int size);
+
+/* Whether the pipes of foreground pipelines are watched */
+int ps_adaptive();
+
+/* Watches the pipe read by the process reader through a duplicate of its
+   read end fd. The duplicate is closed when the reader is reaped
+   (ps_reaped is its pg_add_process callback) or by ps_unwatch_all, so the
+   writer still gets SIGPIPE once the reader is gone. */
+int ps_watch(int fd, pid_t reader);
+int ps_watching();
+void ps_reaped(pid_t pid, int return_status);
+
+/* Doubles the capacity of every watched pipe with less than PIPE_BUF bytes
+   free, i.e. one its writer blocks on */
+void ps_adapt();
+
+/* Closes all duplicates, also called in forked builtins which never exec */
+void ps_unwatch_all();
+
+#endif /* !_PIPESIZE_H_ */
@@ -3,6 +3,8 @@
 
 #include <sys/types.h>
 #include <stddef.h>
+#include <signal.h>
+#include <poll.h>
 
 /* Initializes the procesgroups module, should be run once, return -1 on fail */
 int pg_init();
@@ -10,6 +12,10 @@ int pg_init();
 /* Cleans state after end of procesgroups usage */
 void pg_clean();
 
+/* Whether pg_init has run and pg_clean not, a forked builtin starts with
+   the module cleaned */
+int pg_initialized();
+
 /* Creates new group and return it's id or -1 if error */
 int pg_new(void (*f)(int));
 
@@ -31,6 +37,11 @@ int pg_running(int pgn);
 /* Wait until a specific group stop */
 void pg_wait(int pgn);
 
+/* Same as pg_wait, but calls f every interval milliseconds and after every
+   reaped child until the group stops. Without signalfd f only runs when a
+   child is reaped. */
+void pg_wait_polling(int pgn, int interval, void (*f)());
+
 /* send signal to all processes in group */
 void pg_kill(int pgn, int signal);
 
@@ -48,4 +59,54 @@ void pg_unblock_sigchld();
    waiting for SIGCHLD. */
 void pg_wait_for_sigchld();
 
+/* Reaps children that have already finished, without waiting, and runs their
+   callbacks. In event mode (signalfd available) this is the only place where
+   children are reaped, otherwise the SIGCHLD handler does it as well. */
+void pg_reap();
+
+/* Blocks until fd is readable, reaping children that finish in the meantime.
+   Returns -1 on error. Without event mode it returns immediately. */
+int pg_wait_fd(int fd);
+
+/* poll(2) without a timeout on n fds that reaps children finishing in the
+   meantime, fds must have room for one more. In event mode the signalfd is
+   polled there, otherwise SIGCHLD is let through for the call, so a callback
+   that wakes the caller up through one of fds doesn't miss a child reaped
+   right before poll. Returns what poll returns. */
+int pg_poll(struct pollfd * fds, nfds_t n);
+
+/* Fills the signal sets that a posix_spawn'ed child needs to end up in the
+   same state as a forked child after pg_clean: signals to reset to default and
+   the signal mask. Returns -1 if that state can't be reproduced this way. */
+int pg_spawn_sigsets(sigset_t * sigdefault, sigset_t * sigmask);
+
+/* Marks group as a background job (or not), running background groups count
+   against the limit set by pg_set_max_background */
+void pg_set_background(int pgn, int background);
+
+/* Sets the maximum number of running background groups, 0 means no limit */
+void pg_set_max_background(int max);
+int pg_max_background();
+
+/* Blocks until the number of running background groups is below the limit */
+void pg_wait_background_slot();
+
+/* Calls f for every running background group */
+void pg_foreach_background(void (*f)(int pgn, pid_t pid));
+
+/* Returns the most recently created running background group or -1 */
+int pg_last_background();
+
+/* Waits until background group pgn finishes and gets the status of the last
+   process of its pipeline. Works also for groups that already finished, as
+   long as they haven't been waited for. Returns -1 for unknown groups. */
+int pg_wait_job(int pgn, int * return_status);
+
+/* Waits until any background group finishes, or takes one that already
+   finished and hasn't been waited for. Returns -1 if there are none. */
+int pg_wait_any(int * pgn, int * return_status);
+
+/* Waits until all background groups finish and forgets their statuses */
+void pg_wait_all();
+
 #endif /* !_PROCESSGROUPS_H_ */
@@ -0,0 +1,24 @@
+#ifndef _REWRITE_H_
+#define _REWRITE_H_
+
+#include "siparse.h"
+
+/* Rewriting of parsed pipelines into cheaper equivalent ones:
+     cat FILE | cmd ...     ->  cmd < FILE ...
+     ... | cat | ...        ->  ... | ...
+   The first one changes what happens when FILE can't be opened: the shell
+   reports it and cmd doesn't run, instead of cmd reading empty input. */
+
+#define RW_OFF 0
+#define RW_ON 1
+#define RW_DRY 2 /* only report what would be rewritten */
+
+void rw_set_mode(int mode);
+int rw_mode();
+
+/* Rewrites every pipeline of ln, a line from parselineowned, according to the
+   mode, in dry run mode it reports rewrites to stderr instead. Returns the
+   number of rewrites or -1 if out of memory. */
+int rw_line(line * ln);
+
+#endif /* !_REWRITE_H_ */
@@ -1,6 +1,8 @@
 #ifndef _SIPARSE_H_
 #define _SIPARSE_H_
 
+#include <stddef.h>
+
 typedef struct redirection{
 	char *filename;
 	int flags;
@@ -12,16 +14,22 @@ typedef struct redirection{
 #define RIN 	1
 #define ROUT 	(1<<1)
 #define RAPPEND	(1<<2)
+#define RHEREDOC	(1<<3)	/* <<WORD, filename is the delimiter WORD */
+#define RHERESTR	(1<<4)	/* <<<WORD, filename is the string WORD */
 
-#define RTMASK (RIN|ROUT|RAPPEND)
+#define RTMASK (RIN|ROUT|RAPPEND|RHEREDOC|RHERESTR)
 #define IS_RIN(x)		 (((x)&RTMASK) == RIN )
 #define IS_ROUT(x)		 (((x)&RTMASK) == ROUT )
 #define IS_RAPPEND(x)	 (((x)&RTMASK) == (ROUT|RAPPEND) )
+#define IS_RHEREDOC(x)	 (((x)&RTMASK) == (RIN|RHEREDOC) )
+#define IS_RHERESTR(x)	 (((x)&RTMASK) == (RIN|RHERESTR) )
 
 
 typedef struct command {
 	char** argv; 			/* NULL ended array of arguments */
 	redirection** redirs;	/* NULL ended array of pointers to redirections */
+	int pipesize;			/* capacity asked with |[SIZE] for the pipe into
+							   this command, 0 if not given */
 } command;  
 
 /* NULL ended array of pointers to commands */
@@ -43,12 +51,44 @@ typedef struct line {
 
 /*
  * Parses given string containing sequence of pipelines separated by ';'. 
- * Each pipeline is a sequence of commands separated by '|'.
+ * Each pipeline is a sequence of commands separated by '|', or by '|[SIZE]'
+ * giving the capacity of the pipe in bytes with an optional k or m suffix.
+ * A process substitution <(...) or >(...), up to the first ')', is kept as a
+ * single word and expanded when the command runs.
+ * <<WORD and <<<WORD redirect stdin from a here-document, whose body the
+ * line reader collects from the lines after the line, or from a here-string.
  * Function returns a pointer to the static structure line or NULL if meets a parse error.
- * All structures referenced from the result of the function are statically allocated and shall not be freed.
- * Passing a string longer than MAX_LINE_LENGHT may result in an unspecified behaviour.
+ * All structures referenced from the result of the function are owned by the parser and shall not be freed.
  * Consecutive calls to the function destroy the content of previously returned structures.
  */
 line * parseline(const char *);
 
+/*
+ * Same as parseline but the result stays valid until it is passed to freeline,
+ * so any number of parsed lines can be kept at once.
+ */
+line * parselineowned(const char *);
+void freeline(line *);
+
+/*
+ * Parses SIZE of |[SIZE] at the start of the string: digits with an optional
+ * k or m suffix, at most MAX_PIPE_SIZE bytes. Sets the end pointer past it
+ * and returns the size in bytes, or returns -1 when it isn't a size. Also
+ * used for the sizes given to the pipesize builtin.
+ */
+int parsepipesize(const char *, const char **);
+
+/*
+ * Finds the next here-document in the string, scanning it like parseline
+ * does without changing it. Returns a pointer to the delimiter WORD of its
+ * <<WORD and sets the length of WORD, or returns NULL if there is none.
+ */
+const char * nextheredoc(const char *, size_t *);
+
+/*
+ * Allocates memory freed together with a line returned by parselineowned,
+ * for changes made to its structures. Returns NULL if out of memory.
+ */
+void * linealloc(line *, size_t);
+
 #endif /* !_SIPARSE_H_ */
@@ -0,0 +1,34 @@
+#ifndef _SUBSTITUTION_H_
+#define _SUBSTITUTION_H_
+
+#include "siparse.h"
+
+/* Process substitution: an argument or redirection target <(cmd) is replaced
+   by PROCESS_SUBSTITUTION_DIR/N, N being the read end of a pipe cmd writes
+   to, and >(cmd) by the write end of a pipe cmd reads from. */
+
+/* Whether any argument or redirection of com is a substitution */
+int sb_has(command * com);
+
+/* Starts the text between the parentheses of one substitution, with in_fd
+   and out_fd as its stdin and stdout. Returns -1 on failure. */
+typedef int (*sb_start_func)(const char * text, int in_fd, int out_fd, void * data);
+
+/* Returns a copy of com with every substitution replaced, calling start for
+   each of them, or NULL on failure. The shell keeps the command's ends of
+   the pipes open, close-on-exec, until sb_free. */
+command * sb_expand(command * com, sb_start_func start, void * data);
+
+/* Clears FD_CLOEXEC on the pipe ends of an expanded command, once all its
+   substitutions have started, so only the program executed for it gets
+   them. Returns -1 on failure. */
+int sb_inherit(command * expanded);
+
+/* Closes the pipe ends of an expanded command and frees it */
+void sb_free(command * expanded);
+
+/* Closes the pipe ends of every expanded command but keep, for forked
+   builtins which never exec */
+void sb_close_others(command * keep);
+
+#endif /* !_SUBSTITUTION_H_ */
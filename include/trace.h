@@ -0,0 +1,41 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <sys/types.h>
+
+/* Tracing of the shell's phases into a Chrome trace event file, enabled by
+   setting TRACE_ENV to the file name. Every hook is guarded by a single test
+   of tr_enabled, so a disabled trace costs one predictable branch. */
+
+extern int tr_enabled;
+
+/* Timestamp to pass later as the start of a complete event, 0 when tracing
+   is disabled */
+#define tr_start() (tr_enabled ? tr_now() : 0.0)
+
+/* Opens the trace file, does nothing when file is NULL. Returns -1 on error. */
+int tr_init(const char * file);
+
+/* Writes the remaining events and closes the file, also run at exit. Only
+   the process that called tr_init writes anything. */
+void tr_close();
+
+/* Monotonic time in microseconds */
+double tr_now();
+
+/* Records a phase that began at start and ends now. tid is the process the
+   event belongs to, 0 for the shell, detail is an optional argument. */
+void tr_complete(const char * name, double start, pid_t tid, const char * detail);
+
+/* Records a reaped child, safe to call from a signal handler */
+void tr_exit(pid_t pid, int return_status);
+
+/* Exec handshake: tr_exec_pipe makes a close-on-exec pipe before starting a
+   child, the child reports failure with tr_exec_failed and the parent calls
+   tr_exec_wait, which blocks until the child execs or fails and records the
+   time it took since start. */
+void tr_exec_pipe(int p[2]);
+void tr_exec_failed(int p[2]);
+void tr_exec_wait(int p[2], pid_t pid, double start, const char * name);
+
+#endif /* !_TRACE_H_ */
@@ -5,4 +5,7 @@
 
 void swap_ptr(void ** a, void ** b);
 
+/* FNV-1a hash of a null terminated string */
+unsigned long hash_str(const char * str);
+
 #endif /* !_UTILS_H_ */
@@ -0,0 +1,84 @@
+#include <stdlib.h>
+
+#include "arena.h"
+
+typedef union {
+	long l;
+	double d;
+	void *p;
+} arenaalign;
+
+#define ALIGNED(x) (((x) + sizeof(arenaalign) - 1) & ~(sizeof(arenaalign) - 1))
+#define CHUNKDATA(c) ((char *)(c) + ALIGNED(sizeof(arenachunk)))
+
+void
+arenainit(arena *a){
+	a->first = NULL;
+	a->current = NULL;
+}
+
+/*
+ * appends a new chunk after the current one, keeping the chunks that
+ * follow for later use
+ */
+static arenachunk *
+newchunk(arena *a, size_t size){
+	arenachunk *c;
+
+	if (size < ARENA_CHUNK_SIZE) size = ARENA_CHUNK_SIZE;
+	c = malloc(ALIGNED(sizeof(arenachunk)) + size);
+	if (c == NULL) return NULL;
+	c->size = size;
+	c->used = 0;
+
+	if (a->current == NULL) {
+		c->next = a->first;
+		a->first = c;
+	} else {
+		c->next = a->current->next;
+		a->current->next = c;
+	}
+	a->current = c;
+	return c;
+}
+
+void *
+arenaalloc(arena *a, size_t size){
+	arenachunk *c;
+	void *p;
+
+	size = ALIGNED(size);
+	c = a->current;
+	if (c == NULL && a->first != NULL) {
+		c = a->current = a->first;
+		c->used = 0;
+	}
+	if (c == NULL || c->size - c->used < size) {
+		if (c != NULL && c->next != NULL && c->next->size >= size) {
+			c = a->current = c->next;
+			c->used = 0;
+		} else if ((c = newchunk(a, size)) == NULL) {
+			return NULL;
+		}
+	}
+
+	p = CHUNKDATA(c) + c->used;
+	c->used += size;
+	return p;
+}
+
+void
+arenareset(arena *a){
+	a->current = NULL;
+}
+
+void
+arenafree(arena *a){
+	arenachunk *c, *next;
+
+	for (c = a->first; c != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+	arenainit(a);
+}
@@ -0,0 +1,39 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+/*
+ * size of a chunk, bigger allocations get a chunk of their own
+ */
+#define ARENA_CHUNK_SIZE 4096
+
+typedef struct arenachunk {
+	struct arenachunk *next;
+	size_t size;
+	size_t used;
+} arenachunk;
+
+/*
+ * chunked allocator, memory is only given back all at once
+ */
+typedef struct arena {
+	arenachunk *first;
+	arenachunk *current;
+} arena;
+
+void arenainit(arena *);
+
+/*
+ * returns size bytes aligned for any type or NULL if out of memory
+ */
+void * arenaalloc(arena *, size_t);
+
+/*
+ * forgets all allocations in constant time, the chunks are reused
+ */
+void arenareset(arena *);
+
+void arenafree(arena *);
+
+#endif /* !_ARENA_H_ */
@@ -0,0 +1,283 @@
+/*
+ * Hand-written parser accepting the same language as siparse.y and
+ * siparse.lex and building the same structures.
+ *
+ * The line is copied to the arena once and words are terminated in place,
+ * so argv strings and file names point into that copy. Words and comments
+ * are found with strcspn, which the C library implements with vector
+ * instructions.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "siparse.h"
+#include "siparseutils.h"
+
+/*
+ * tokens other than the single characters |;<>&\n
+ */
+#define TWORD		256
+#define TAPPEND		257	/* >> */
+#define TCOMMENT	258
+#define TEND		259
+#define TPIPESIZE	260	/* |[SIZE] */
+#define TERROR		261	/* out of memory */
+#define THEREDOC	262	/* << */
+#define THERESTR	263	/* <<< */
+
+#define WORDDELIMS	"|;<>\n \t&#"
+
+typedef struct scanner {
+	char *pos;		/* next character to look at */
+	char carried;	/* delimiter overwritten by the end of the last word */
+	int token;
+	char *word;		/* value of TWORD */
+	size_t length;	/* of word, which is only terminated when not scanonly */
+	int size;		/* value of TPIPESIZE */
+	int scanonly;	/* finds tokens without changing or copying the string */
+} scanner;
+
+/*
+ * c followed by (...) up to the first ')' is one word, c being < or >; it is
+ * copied as c may be the carried delimiter and the character after ')' can
+ * start the next word
+ */
+static void
+processsubstitution(scanner *s, char c){
+	size_t length;
+
+	length = strcspn(s->pos, ")\n");
+	if (s->pos[length] != ')') {
+		s->token = c;
+		return;
+	}
+	s->length = length + 2;
+	if (s->scanonly) {
+		s->word = s->pos - 1;
+		s->pos += length + 1;
+		s->token = TWORD;
+		return;
+	}
+	s->word = copytobuffer(s->pos - 1, length + 3);
+	if (s->word == NULL) {
+		s->token = TERROR;
+		return;
+	}
+	s->word[0] = c;
+	s->word[length + 2] = '\0';
+	s->pos += length + 1;
+	s->token = TWORD;
+}
+
+static void
+nexttoken(scanner *s){
+	char c, *end;
+
+	for (;;) {
+		if (s->carried) {
+			c = s->carried;
+			s->carried = '\0';
+		} else {
+			c = *s->pos;
+			if (c == '\0') {
+				s->token = TEND;
+				return;
+			}
+			s->pos++;
+		}
+		if (c != ' ' && c != '\t') break;
+	}
+
+	switch (c) {
+	case '|':
+		/* |[digits] with an optional k or m suffix, like siparse.lex, is
+		   a size even when parsepipesize rejects the value */
+		end = s->pos + 1 + strspn(s->pos + 1, "0123456789");
+		if (*s->pos == '[' && end > s->pos + 1) {
+			if (*end != '\0' && strchr("kKmM", *end) != NULL) end++;
+			if (*end == ']') {
+				s->size = parsepipesize(s->pos + 1, (const char **) &end);
+				s->pos = end + 1;
+				s->token = TPIPESIZE;
+				return;
+			}
+		}
+		s->token = c;
+		return;
+	case '<':
+		if (*s->pos == '(') {
+			processsubstitution(s, c);
+			return;
+		}
+		if (*s->pos == '<') {
+			s->pos++;
+			if (*s->pos == '<') {
+				s->pos++;
+				s->token = THERESTR;
+				return;
+			}
+			s->token = THEREDOC;
+			return;
+		}
+		s->token = c;
+		return;
+	case '>':
+		if (*s->pos == '(') {
+			processsubstitution(s, c);
+			return;
+		}
+		if (*s->pos == '>') {
+			s->pos++;
+			s->token = TAPPEND;
+			return;
+		}
+		/* fall through */
+	case ';': case '&': case '\n':
+		s->token = c;
+		return;
+	case '#':
+		s->pos += strcspn(s->pos, "\n");
+		s->token = TCOMMENT;
+		return;
+	}
+
+	s->word = s->pos - 1;
+	s->pos += strcspn(s->pos, WORDDELIMS);
+	s->length = s->pos - s->word;
+	s->token = TWORD;
+	if (s->scanonly) return;
+	s->carried = *s->pos;
+	if (s->carried != '\0') {
+		*s->pos = '\0';
+		s->pos++;
+	}
+}
+
+/*
+ * single: word* (('<' | '<<' | '<<<' | '>' | '>>') word)*
+ */
+static command *
+parsecommand(scanner *s){
+	command *com;
+	redirection *red;
+	int flags;
+
+	while (s->token == TWORD) {
+		if (appendtoargv(s->word)) return NULL;
+		nexttoken(s);
+	}
+
+	com = nextcommand();
+	if (com == NULL || (com->argv = closeargv()) == NULL) return NULL;
+
+	for (;;) {
+		switch (s->token) {
+		case '<':		flags = RIN; break;
+		case THEREDOC:	flags = RIN | RHEREDOC; break;
+		case THERESTR:	flags = RIN | RHERESTR; break;
+		case '>':		flags = ROUT; break;
+		case TAPPEND:	flags = ROUT | RAPPEND; break;
+		default:		flags = 0; break;
+		}
+		if (!flags) break;
+
+		nexttoken(s);
+		if (s->token != TWORD) return NULL;
+		red = nextredir();
+		if (red == NULL) return NULL;
+		red->filename = s->word;
+		red->flags = flags;
+		if (appendtoredirseq(red)) return NULL;
+		nexttoken(s);
+	}
+
+	com->redirs = closeredirseq();
+	if (com->redirs == NULL) return NULL;
+	return com;
+}
+
+/*
+ * pipeline: single (('|' | '|[SIZE]') single)*
+ */
+static pipeline
+parsepipeline(scanner *s){
+	command *com;
+	int size;
+
+	size = 0;
+	for (;;) {
+		com = parsecommand(s);
+		if (com == NULL || appendtopipeline(com)) return NULL;
+		com->pipesize = size;
+		if (s->token == '|') {
+			size = 0;
+		} else if (s->token == TPIPESIZE) {
+			size = s->size;
+			if (size == -1) return NULL;
+		} else {
+			break;
+		}
+		nexttoken(s);
+	}
+	return closepipeline();
+}
+
+/*
+ * line: pipeline (';' pipeline)* '&'? comment? '\n'?
+ */
+int
+parsestring(const char *str, line *ln){
+	scanner s;
+	pipeline pipeln;
+
+	s.pos = copytobuffer(str, strlen(str) + 1);
+	if (s.pos == NULL) return -1;
+	s.carried = '\0';
+	s.scanonly = 0;
+	nexttoken(&s);
+
+	for (;;) {
+		pipeln = parsepipeline(&s);
+		if (pipeln == NULL || appendtopipelineseq(pipeln)) return -1;
+		if (s.token != ';') break;
+		nexttoken(&s);
+	}
+	ln->pipelines = closepipelineseq();
+	if (ln->pipelines == NULL) return -1;
+
+	ln->flags = 0;
+	if (s.token == '&') {
+		ln->flags = LINBACKGROUND;
+		nexttoken(&s);
+	}
+	if (s.token == TCOMMENT) nexttoken(&s);
+	if (s.token == '\n') nexttoken(&s);
+
+	return s.token == TEND ? 0 : -1;
+}
+
+/*
+ * the word after the first << token, with the tokens found exactly like
+ * parsestring finds them
+ */
+const char *
+nextheredoc(const char *str, size_t *length){
+	scanner s;
+	int heredoc;
+
+	if (strstr(str, "<<") == NULL) return NULL;
+
+	s.pos = (char *) str;
+	s.carried = '\0';
+	s.scanonly = 1;
+	nexttoken(&s);
+	while (s.token != TEND) {
+		heredoc = s.token == THEREDOC;
+		nexttoken(&s);
+		if (heredoc && s.token == TWORD) {
+			*length = s.length;
+			return s.word;
+		}
+	}
+	return NULL;
+}
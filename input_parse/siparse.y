@@ -2,8 +2,10 @@
 	#include <siparse.h>
 	#include "siparseutils.h"
     #include <stdio.h>
+    #include <string.h>
     
 	extern int yyleng;
+	extern size_t scannedlength;
 
 	int yylex(void);
 	void yyerror(char *);
@@ -17,6 +19,7 @@
 
 %union{
 	int flags;
+	int size;
 	char *name;
 	char **argv;
 	redirection *redir;
@@ -30,11 +33,15 @@
 %token SSTRING
 %token OAPPREDIR
 %token COMMENT
+%token OPIPESIZE
+%token OHEREDOC
+%token OHERESTR
 %%
 
 line:
 	pipelineseq mamp mcomment mendl {
 			parsed_line.pipelines = closepipelineseq(); 
+			if (parsed_line.pipelines == NULL) YYABORT;
 			parsed_line.flags= $2.flags;
 			$$.parsedln = &parsed_line;
 		}
@@ -57,25 +64,37 @@ mendl:
 
 pipelineseq:
 	pipelineseq ';' prepipeline{
-			$$.pipelnsq = appendtopipelineseq($3.pipeln);
+			if (appendtopipelineseq($3.pipeln)) YYABORT;
 		}
 	| prepipeline{
-			$$.pipelnsq = appendtopipelineseq($1.pipeln);
+			if (appendtopipelineseq($1.pipeln)) YYABORT;
 		}
 	;
 
 prepipeline:
 	pipeline {
-			closepipeline();
+			$$.pipeln = closepipeline();
+			if ($$.pipeln == NULL) YYABORT;
 		}
 	;
 
 pipeline:
-	pipeline '|' single {
-			$$.pipeln = appendtopipeline($3.comm);
+	pipeline pipe single {
+			if ($3.comm != NULL) $3.comm->pipesize = $2.size;
+			if (appendtopipeline($3.comm)) YYABORT;
 		}
 	| single {
-			$$.pipeln = appendtopipeline($1.comm);
+			if (appendtopipeline($1.comm)) YYABORT;
+		}
+	;
+
+pipe:
+	'|' { $$.size = 0; }
+	| OPIPESIZE {
+			const char *end;
+
+			$$.size = parsepipesize($1.name + 2, &end);
+			if ($$.size == -1) YYABORT;
 		}
 	;
 
@@ -85,6 +104,7 @@ single:
 				$$.comm= NULL;	
 			} else {
 				command *com= nextcommand();
+				if (com == NULL) YYABORT;
 				com->argv = $1.argv;
 				com->redirs = $2.redirseq;
 				$$.comm = com;
@@ -93,26 +113,33 @@ single:
 	;
 
 allnames:
-		names { $$.argv = closeargv(); }
+		names {
+			$$.argv = closeargv();
+			if ($$.argv == NULL) YYABORT;
+		}
 
 
 allredirs:
-		 redirs { $$.redirseq = closeredirseq(); }
+		 redirs {
+			$$.redirseq = closeredirseq();
+			if ($$.redirseq == NULL) YYABORT;
+		}
 
 names:
 	names name {
-			$$.argv = appendtoargv($2.name);
+			if (appendtoargv($2.name)) YYABORT;
 		} 
 	|	 
 	;
 
 name:	SSTRING {
 			$$.name= copytobuffer(yyval.name, yyleng+1);
+			if ($$.name == NULL) YYABORT;
 		};
 
 redirs:
 	redirs redir {
-			$$.redirseq = appendtoredirseq($2.redir);
+			if (appendtoredirseq($2.redir)) YYABORT;
 		}
 	|	{	$$.redirseq = NULL; };
 	;
@@ -124,6 +151,8 @@ redir:
 
 redirIn:
 	'<' rname { $2.redir->flags = RIN; $$=$2; }
+	| OHEREDOC rname { $2.redir->flags = RIN | RHEREDOC; $$=$2; }
+	| OHERESTR rname { $2.redir->flags = RIN | RHERESTR; $$=$2; }
 	;
 
 redirOut:
@@ -136,6 +165,7 @@ rname:
 			redirection * red;
 
 			red=nextredir();
+			if (red == NULL) YYABORT;
 			red->filename = $1.name;
 			$$.redir= red;
 		}
@@ -146,15 +176,33 @@ void yyerror(char *s) {
 }
 
 
-line * parseline(const char *str){
+int parsestring(const char *str, line *ln){
 	int parseresult;
 
-	resetutils();
 	switchinputbuftostring(str);
 	parseresult = yyparse();
 	freestringinputbuf();
 
-	if (parseresult) return NULL;
-	return &parsed_line;
+	if (parseresult) return -1;
+	*ln = parsed_line;
+	return 0;
 }
 
+const char *nextheredoc(const char *str, size_t *length){
+	int token, heredoc;
+
+	if (strstr(str, "<<") == NULL) return NULL;
+
+	switchinputbuftostring(str);
+	heredoc = 0;
+	while ((token = yylex()) != 0) {
+		if (heredoc && token == SSTRING) {
+			*length = yyleng;
+			freestringinputbuf();
+			return str + scannedlength - *length;
+		}
+		heredoc = token == OHEREDOC;
+	}
+	freestringinputbuf();
+	return NULL;
+}
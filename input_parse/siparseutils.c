@@ -6,195 +6,236 @@
 #include "siparse.h"
 #include "siparseutils.h"
 
-void
-resetutils(void){
-		resetbuffer();
-		resetargvs();
-		resetcommands();
-		resetredirs();
-		resetredirseqs();
-		resetpipelines();
-		resetpipelineseqs();
-}
+/*
+ * everything returned below is allocated in this arena
+ */
+static arena * currentarena;
 
 /*
- * buffer for string from the parsed line
+ * sequences are collected in growing scratch vectors that are reused for
+ * every line and copied to the arena when closed
  */
-static char linebuffer[MAX_LINE_LENGTH+1];
-static const char *linebufferend= linebuffer+MAX_LINE_LENGTH;
-static char *bufptr=linebuffer;
+typedef struct sequence {
+	void ** items;
+	size_t count;
+	size_t size;
+} sequence;
+
+static sequence currentargs, currentredirs, currentcommands, currentpipelines;
+
+static int
+appendtoseq(sequence *seq, void *item){
+	void **items;
+	size_t size;
+
+	if (seq->count == seq->size) {
+		size = seq->size ? seq->size * 2 : 16;
+		items = realloc(seq->items, size * sizeof(void *));
+		if (items == NULL) return -1;
+		seq->items = items;
+		seq->size = size;
+	}
+	seq->items[seq->count++] = item;
+	return 0;
+}
+
+void
+resetutils(arena *a){
+		currentarena = a;
+		currentargs.count = 0;
+		currentredirs.count = 0;
+		currentcommands.count = 0;
+		currentpipelines.count = 0;
+}
 
 /*
  * name is 0 terminated string
  * length include terminating 0
  */
 char *
-copytobuffer(const char *name, const short length){
+copytobuffer(const char *name, const size_t length){
 	char *saved;
-	int copied;
 
-	saved=bufptr;
-	bufptr+=length;
-	if (bufptr > linebufferend) return NULL;
-	strncpy(saved, name, length);
+	saved = arenaalloc(currentarena, length);
+	if (saved == NULL) return NULL;
+	memcpy(saved, name, length);
 	return saved;
 }
 
-void 
-resetbuffer(void){
-	bufptr= linebuffer;
-}
-
 /* 
- * buffer for args
- * each argv is NULL terminated substring of the buffer
+ * args
+ * each argv is NULL terminated array of strings from the arena
  */
-static char * argvs[MAX_ARGS*2];
-static char **nextarg = argvs;
-static char **currentargv = argvs;
-
-char ** 
+int
 appendtoargv(char* arg){
-	*nextarg = arg;
-	nextarg++;
-	return currentargv;
+	return appendtoseq(&currentargs, arg);
 }
 
 char **
 closeargv(void){
-	char ** oldstart;
-
-	appendtoargv(NULL);
-	oldstart = currentargv;
-	currentargv = nextarg;
-	return oldstart;
-}
-
-void
-resetargvs(void){
-	currentargv=argvs;
-	nextarg=currentargv;
+	char ** argv;
+	size_t i;
+
+	argv = arenaalloc(currentarena, (currentargs.count + 1) * sizeof(char *));
+	if (argv == NULL) return NULL;
+	for (i = 0; i < currentargs.count; i++) argv[i] = currentargs.items[i];
+	argv[i] = NULL;
+	currentargs.count = 0;
+	return argv;
 }
 
 /*
- * buffer for commands
+ * commands
  */
-static command commandsbuf[MAX_COMMANDS+1];
-static command * nextcom=commandsbuf;
-
 command *
 nextcommand(void){
-	command * curr;
-	
-	curr = nextcom;
-	nextcom++;
-	return curr;
+	command *com;
+
+	com = arenaalloc(currentarena, sizeof(command));
+	if (com != NULL) com->pipesize = 0;
+	return com;
 }
 
-void
-resetcommands(void){
-	nextcom= commandsbuf;
+int
+parsepipesize(const char *str, const char **end){
+	long size;
+
+	if (*str < '0' || *str > '9') return -1;
+	for (size = 0; *str >= '0' && *str <= '9'; str++) {
+		size = size * 10 + (*str - '0');
+		if (size > MAX_PIPE_SIZE) return -1;
+	}
+	if (*str == 'k' || *str == 'K') {
+		size <<= 10;
+		str++;
+	} else if (*str == 'm' || *str == 'M') {
+		size <<= 20;
+		str++;
+	}
+	if (size == 0 || size > MAX_PIPE_SIZE) return -1;
+	*end = str;
+	return size;
 }
 
 /* 
- * buffer for redirections
+ * redirections
  */
-static redirection redirsbuf[MAX_REDIRS];
-static redirection *nextred;
-
-redirection * nextredir(void){
-	return (nextred++);	
+redirection *
+nextredir(void){
+	return arenaalloc(currentarena, sizeof(redirection));
 }
 
-void resetredirs(void){
-	nextred = redirsbuf;
+int
+appendtoredirseq(redirection * redir){
+	return appendtoseq(&currentredirs, redir);
 }
 
-static redirection *  redirseqbuf[MAX_REDIRS*2];
-static redirection ** currentredirseq;
-static redirection ** currentredirseqstart;
-
-redirection ** appendtoredirseq(redirection * redir){
-
-	*currentredirseq = redir;
-	currentredirseq++;
-
-	return currentredirseqstart;
+redirection **
+closeredirseq(void){
+	redirection ** redirs;
+	size_t i;
+
+	redirs = arenaalloc(currentarena, (currentredirs.count + 1) * sizeof(redirection *));
+	if (redirs == NULL) return NULL;
+	for (i = 0; i < currentredirs.count; i++) redirs[i] = currentredirs.items[i];
+	redirs[i] = NULL;
+	currentredirs.count = 0;
+	return redirs;
 }
 
-redirection ** closeredirseq(void){
-	redirection ** oldstart;
-		
-	oldstart = appendtoredirseq(NULL);
-	currentredirseqstart = currentredirseq;
-	
-	return oldstart;
+/*
+ * pipelines
+ */
+int
+appendtopipeline(command * comm){
+	return appendtoseq(&currentcommands, comm);
 }
 
-void resetredirseqs(void){
-	currentredirseqstart = redirseqbuf;
-	currentredirseq = redirseqbuf;
+pipeline
+closepipeline(void){
+	pipeline pipeln;
+	size_t i;
+
+	pipeln = arenaalloc(currentarena, (currentcommands.count + 1) * sizeof(command *));
+	if (pipeln == NULL) return NULL;
+	for (i = 0; i < currentcommands.count; i++) pipeln[i] = currentcommands.items[i];
+	pipeln[i] = NULL;
+	currentcommands.count = 0;
+	return pipeln;
 }
 
 /*
- * pipelines buffer
+ * pipeline sequences
  */
-
-static command *	pipelinesbuf[MAX_COMMANDS*2];
-static command **	currentpipelinecomm;
-static command **	currentpipelinestart;
-
-pipeline appendtopipeline(command * comm){
-
-	*currentpipelinecomm = comm;
-	currentpipelinecomm++;
-
-	return currentpipelinestart;
+int
+appendtopipelineseq(pipeline pipeln){
+	return appendtoseq(&currentpipelines, pipeln);
 }
 
-pipeline closepipeline(void){
-	command ** oldstart;
-		
-	oldstart = appendtopipeline(NULL);
-	currentpipelinestart = currentpipelinecomm;
-	
-	return oldstart;
-}
-
-void resetpipelines(void){
-	currentpipelinecomm = pipelinesbuf;
-	currentpipelinestart = pipelinesbuf;
+pipelineseq
+closepipelineseq(void){
+	pipelineseq pipelines;
+	size_t i;
+
+	pipelines = arenaalloc(currentarena, (currentpipelines.count + 1) * sizeof(pipeline));
+	if (pipelines == NULL) return NULL;
+	for (i = 0; i < currentpipelines.count; i++) pipelines[i] = currentpipelines.items[i];
+	pipelines[i] = NULL;
+	currentpipelines.count = 0;
+	return pipelines;
 }
 
 /*
- * pipelinesseq buffer
+ * arena and result of parseline
  */
+static arena linearena;
+static line parsed_line;
+
+typedef struct ownedline {
+	line ln;		/* first, freeline gets a pointer to it */
+	arena mem;
+} ownedline;
+
+line *
+parseline(const char *str){
+	arenareset(&linearena);
+	resetutils(&linearena);
+	if (parsestring(str, &parsed_line)) return NULL;
+	return &parsed_line;
+}
 
-static pipeline		pipelineseqsbuf[MAX_PIPELINES*2];
-static pipeline*	currentpipeline;
-static pipeline*	currentpipelineseqstart;
-
-pipelineseq appendtopipelineseq(command ** pipeline){
+line *
+parselineowned(const char *str){
+	ownedline *owned;
 
-	*currentpipeline = pipeline;
-	currentpipeline++;
+	owned = malloc(sizeof(ownedline));
+	if (owned == NULL) return NULL;
+	arenainit(&owned->mem);
 
-	return currentpipelineseqstart;
+	resetutils(&owned->mem);
+	if (parsestring(str, &owned->ln)) {
+		arenafree(&owned->mem);
+		free(owned);
+		return NULL;
+	}
+	return &owned->ln;
 }
 
-pipelineseq closepipelineseq(void){
-	pipelineseq oldstart;
-		
-	oldstart = appendtopipelineseq(NULL);
-	currentpipelineseqstart = currentpipeline;
-	
-	return oldstart;
+void *
+linealloc(line *ln, size_t size){
+	return arenaalloc(&((ownedline *) ln)->mem, size);
 }
 
-void resetpipelineseqs(void){
-	currentpipeline = pipelineseqsbuf;
-	currentpipelineseqstart = pipelineseqsbuf;
+void
+freeline(line *ln){
+	ownedline *owned;
+
+	if (ln == NULL) return;
+	owned = (ownedline *) ln;
+	arenafree(&owned->mem);
+	free(owned);
 }
+
 /*
  * printing
 void printcommand(command *com){
@@ -1,49 +1,52 @@
+#include "arena.h"
 
-#define MAX_COMMANDS (MAX_LINE_LENGTH/2 +1)
-#define MAX_PIPELINES MAX_COMMANDS
-#define MAX_ARGS MAX_COMMANDS
-#define MAX_REDIRS MAX_COMMANDS
+/*
+ * starts a new line, everything parsed from now on is allocated in the
+ * given arena
+ */
+void resetutils(arena *);
 
-void resetutils(void);
+/*
+ * parses str into ln, allocating from the arena given to resetutils,
+ * returns -1 on a parse error; implemented by the parser chosen at build time
+ */
+int parsestring(const char *, line *);
 
 /*
- * buffer for string from the parsed line
+ * functions below return NULL, or -1 for the appenders, when out of memory
  */
 
-char * copytobuffer(const char *, const short);
-void resetbuffer(void);
+/*
+ * copy of a string from the parsed line
+ */
+
+char * copytobuffer(const char *, const size_t);
 
 /* 
- * buffer for args
- * each argv is NULL terminated substring of the buffer
+ * args
+ * each argv is NULL terminated array of strings
  */
 
-char ** appendtoargv(char*);
+int appendtoargv(char*);
 char ** closeargv(void);
-void resetargvs(void);
 
 /*
- * buffer for commands
+ * commands
  */
 command * nextcommand(void);
-void resetcommands(void);
 
 /*
- * buffer for redirections
+ * redirections
  */
 redirection * nextredir(void);
-void resetredirs(void);
-redirection ** appendtoredirseq(redirection * );
-
+int appendtoredirseq(redirection * );
 redirection ** closeredirseq(void);
-void resetredirseqs(void);
 
-pipeline appendtopipeline(command *);
+/*
+ * pipelines and sequences of pipelines
+ */
+int appendtopipeline(command *);
 pipeline closepipeline(void);
-void resetpipelines(void);
-
 
-pipelineseq appendtopipelineseq(command **);
+int appendtopipelineseq(pipeline);
 pipelineseq closepipelineseq(void);
-void resetpipelineseqs(void);
-	
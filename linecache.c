@@ -0,0 +1,146 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "utils.h"
+#include "siparse.h"
+#include "linecache.h"
+
+#define LC_BUCKETS 128 /* power of two, at least LINE_CACHE_SIZE */
+
+struct lc_entry {
+	line * ln;
+	unsigned long hash;
+	size_t length;
+	struct lc_entry * next;   /* in the bucket */
+	struct lc_entry * newer;  /* towards the most recently used entry */
+	struct lc_entry * older;
+	char text[1];
+};
+
+static lc_entry * buckets[LC_BUCKETS];
+static lc_entry * newest = NULL;
+static lc_entry * oldest = NULL;
+static int entries = 0;
+static long hits = 0;
+static long misses = 0;
+
+static void _lc_free(lc_entry * e) {
+	freeline(e->ln);
+	free(e);
+}
+
+/* Unlinks e from its bucket and from the recency list */
+static void _lc_unlink(lc_entry * e) {
+	lc_entry ** prev;
+
+	for (prev = &buckets[e->hash & (LC_BUCKETS - 1)]; *prev != e; prev = &(*prev)->next);
+	*prev = e->next;
+
+	if (e->newer != NULL) {
+		e->newer->older = e->older;
+	} else {
+		newest = e->older;
+	}
+	if (e->older != NULL) {
+		e->older->newer = e->newer;
+	} else {
+		oldest = e->newer;
+	}
+	--entries;
+}
+
+static lc_entry * _lc_find(const char * text, unsigned long hash) {
+	lc_entry * e;
+
+	for (e = buckets[hash & (LC_BUCKETS - 1)]; e != NULL; e = e->next) {
+		if (e->hash == hash && strcmp(e->text, text) == 0) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+lc_entry * lc_take(const char * text) {
+	lc_entry * e;
+
+	e = _lc_find(text, hash_str(text));
+	if (e == NULL) {
+		++misses;
+		return NULL;
+	}
+	++hits;
+	_lc_unlink(e);
+	return e;
+}
+
+lc_entry * lc_new(const char * text, line * ln) {
+	lc_entry * e;
+	size_t length;
+
+	length = strlen(text);
+	e = malloc(sizeof(lc_entry) + length);
+	if (e == NULL) {
+		return NULL;
+	}
+	memcpy(e->text, text, length + 1);
+	e->length = length;
+	e->hash = hash_str(text);
+	e->ln = ln;
+	return e;
+}
+
+line * lc_line(lc_entry * entry) {
+	return entry->ln;
+}
+
+void lc_put(lc_entry * e) {
+	lc_entry * old;
+
+	if (e->length > LINE_CACHE_MAX_LENGTH || LINE_CACHE_SIZE == 0) {
+		_lc_free(e);
+		return;
+	}
+
+	/* a nested run of the same text may have cached it meanwhile */
+	old = _lc_find(e->text, e->hash);
+	if (old != NULL) {
+		_lc_unlink(old);
+		_lc_free(old);
+	}
+	if (entries == LINE_CACHE_SIZE) {
+		old = oldest;
+		_lc_unlink(old);
+		_lc_free(old);
+	}
+
+	e->next = buckets[e->hash & (LC_BUCKETS - 1)];
+	buckets[e->hash & (LC_BUCKETS - 1)] = e;
+	e->newer = NULL;
+	e->older = newest;
+	if (newest != NULL) {
+		newest->newer = e;
+	} else {
+		oldest = e;
+	}
+	newest = e;
+	++entries;
+}
+
+void lc_clear() {
+	lc_entry * e;
+
+	while ((e = oldest) != NULL) {
+		_lc_unlink(e);
+		_lc_free(e);
+	}
+	hits = misses = 0;
+}
+
+void lc_stats(long * hits_result, long * misses_result, int * entries_result) {
+	*hits_result = hits;
+	*misses_result = misses;
+	*entries_result = entries;
+}
@@ -1,6 +1,7 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -10,6 +11,102 @@
 #include "linereader.h"
 #include "config.h"
 #include "utils.h"
+#include "siparse.h"
+
+/* Maps the rest of stdin when it is a regular file, i.e. a script and never
+   a terminal, so lines are found without a read per buffer. The mapping is
+   read-only, so its pages are never copied, and each line is copied out of
+   it on its own. On any failure the reader just uses read. */
+void _lr_map(struct linereader * lr, struct stat * fd_stat) {
+	off_t offset, aligned;
+	long page_size;
+	void * map;
+
+	lr->map = NULL;
+	if (!S_ISREG(fd_stat->st_mode)) {
+		return;
+	}
+
+	offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+	page_size = sysconf(_SC_PAGESIZE);
+	if (offset == (off_t) -1 || page_size <= 0 || offset >= fd_stat->st_size) {
+		return;
+	}
+	aligned = offset - offset % page_size;
+
+	map = mmap(NULL, fd_stat->st_size - aligned, PROT_READ, MAP_PRIVATE,
+	    STDIN_FILENO, aligned);
+	if (map == MAP_FAILED) {
+		return;
+	}
+
+	/* leave the file offset after the mapped part, the read fallback for a
+	   growing file continues from there. Commands of the script reading the
+	   shell's stdin get EOF, not the rest of the script. */
+	if (lseek(STDIN_FILENO, fd_stat->st_size, SEEK_SET) == (off_t) -1) {
+		munmap(map, fd_stat->st_size - aligned);
+		return;
+	}
+
+	lr->map = map;
+	lr->map_size = fd_stat->st_size - aligned;
+	lr->map_offset = offset - aligned;
+}
+
+void _lr_unmap(struct linereader * lr) {
+	munmap(lr->map, lr->map_size); /* ignore errors */
+	lr->map = NULL;
+}
+
+/* Makes room for at least size bytes in a buffer, growing it geometrically
+   so long lines are read in linear time */
+int _lr_grow(char ** buffer, size_t * buffer_capacity, size_t size) {
+	size_t capacity;
+	char * grown;
+
+	if (size <= *buffer_capacity) {
+		return 0;
+	}
+	capacity = *buffer_capacity ? *buffer_capacity : LINE_BUFFER_SIZE;
+	for (; capacity < size; capacity *= 2);
+
+	grown = realloc(*buffer, capacity);
+	if (grown == NULL) {
+		return -1;
+	}
+	*buffer = grown;
+	*buffer_capacity = capacity;
+	return 0;
+}
+
+int _lr_reserve(struct linereader * lr, size_t size) {
+	return _lr_grow(&lr->buffor, &lr->capacity, size);
+}
+
+/* Copies the next line from the mapping into the buffer and sets *res to
+   it, or to NULL and unmaps when nothing is left */
+int _lr_map_readline(struct linereader * lr, char const** res) {
+	char * start, * end;
+	size_t length;
+
+	*res = NULL;
+	if (lr->map_offset >= lr->map_size) {
+		_lr_unmap(lr);
+		return 0;
+	}
+
+	start = lr->map + lr->map_offset;
+	end = memchr(start, '\n', lr->map_size - lr->map_offset);
+	length = end != NULL ? (size_t) (end - start) : lr->map_size - lr->map_offset;
+	if (_lr_reserve(lr, length + 1) == -1) {
+		return -1;
+	}
+	memcpy(lr->buffor, start, length);
+	lr->buffor[length] = '\0';
+	lr->map_offset += length + 1;
+	*res = lr->buffor;
+	return 0;
+}
 
 int lr_init(struct linereader * lr) {
 	int result;
@@ -21,89 +118,176 @@ int lr_init(struct linereader * lr) {
 	}
 	lr->print_prompt = S_ISCHR(fd_stat.st_mode);
 
-	lr->buffor = malloc(MAX_LINE_LENGTH + 1);
+	lr->buffor = malloc(LINE_BUFFER_SIZE);
 	if (!lr->buffor) {
 		goto error;
 	}
-	lr->offset = 0;
-	lr->last_line_length = -1;
+	lr->capacity = LINE_BUFFER_SIZE;
+	lr->start = lr->end = lr->scanned = 0;
+	lr->wait_input = NULL;
+	lr->docs = NULL;
+	lr->docs_capacity = 0;
+	lr->heredocs = NULL;
+	lr->heredocs_length = 0;
+	_lr_map(lr, &fd_stat);
 
 	return 0;
 error:
 	return -1;
 }
 
-int find_newline(char * buf, ssize_t size) {
-	int i;
-	for (i = 0; i < size; ++i) {
-		if (buf[i] == '\n') {
-			return i;
-		}
+/* Moves the unfinished line to the front of the buffer and grows the buffer
+   when that still leaves less than a quarter free. One byte is always kept
+   for the terminator of a last line without a newline. */
+int _lr_make_room(struct linereader * lr) {
+	if (lr->start > 0) {
+		lr->end -= lr->start;
+		memmove(lr->buffor, lr->buffor + lr->start, lr->end);
+		lr->start = 0;
 	}
-	return -1;
+	if (lr->capacity - lr->end - 1 < lr->capacity / 4) {
+		return _lr_reserve(lr, lr->capacity * 2);
+	}
+	return 0;
 }
 
-int lr_readline(struct linereader * lr, char const** res) {
-	int line_end, finished_line, ignore_command, read_bytes;
+/* Returns the next line of input, printing prompt first on a terminal */
+int _lr_next(struct linereader * lr, const char * prompt, char const** res) {
+	char * line_end;
+	ssize_t read_bytes;
 
-	finished_line = 1;
-	ignore_command = 0;
-	read_bytes = 1;
+	if (lr->map != NULL) {
+		if (_lr_map_readline(lr, res) == -1) {
+			goto error;
+		}
+		if (*res != NULL) {
+			return 0;
+		}
+	}
 
-	if (lr->last_line_length != -1) {
-		lr->offset -= lr->last_line_length + 1;
-		memmove(lr->buffor, lr->buffor + lr->last_line_length + 1, lr->offset);
-		lr->last_line_length = -1;
+	if (lr->print_prompt) {
+		printf("%s", prompt);
+		fflush(stdout);
 	}
 
-	while (read_bytes > 0 || lr->offset > 0) {
-		if (lr->print_prompt && finished_line) {
-			finished_line = 0;
-			printf(PROMPT_STR);
-			fflush(stdout);
+	for (;;) {
+		/* only the bytes read since the last scan can hold the newline */
+		line_end = memchr(lr->buffor + lr->start + lr->scanned, '\n',
+		    lr->end - lr->start - lr->scanned);
+		if (line_end != NULL) {
+			*line_end = '\0';
+			*res = lr->buffor + lr->start;
+			lr->start = line_end - lr->buffor + 1;
+			lr->scanned = 0;
+			return 0;
 		}
+		lr->scanned = lr->end - lr->start;
 
-		line_end = find_newline(lr->buffor, lr->offset);
-		if (line_end == -1 && lr->offset == MAX_LINE_LENGTH + 1) { /* line too long */
-			lr->offset = 0;
-			ignore_command = 1;
+		if (lr->capacity - lr->end - 1 < lr->capacity / 4 && _lr_make_room(lr) == -1) {
+			goto error;
+		}
+		if (lr->wait_input != NULL && lr->wait_input(STDIN_FILENO) == -1) {
+			goto error;
+		}
+		EINTR_RETRY(read_bytes, read(STDIN_FILENO, lr->buffor + lr->end, lr->capacity - lr->end - 1));
+		if (read_bytes == -1) {
+			goto error;
+		}
+		if (read_bytes == 0) {
+			break;
 		}
+		lr->end += read_bytes;
+	}
 
-		if (line_end != -1 || read_bytes == 0) {
-			if (line_end == -1) {
-				line_end = lr->offset;
-			}
-			lr->buffor[line_end] = '\0';
+	if (lr->start == lr->end) {
+		lr->start = lr->end = lr->scanned = 0;
+		*res = NULL;
+		return 0;
+	}
+
+	/* last line without a newline */
+	lr->buffor[lr->end] = '\0';
+	*res = lr->buffor + lr->start;
+	lr->start = lr->end;
+	lr->scanned = 0;
+	return 0;
+error:
+	return -1;
+}
 
-			if (!ignore_command) {
-				lr->last_line_length = line_end;
+/* Copies line to docs and reads the bodies of its here-documents after it.
+   A body missing its delimiter line ends with the input. */
+int _lr_read_heredocs(struct linereader * lr, const char * line) {
+	const char * word, * body;
+	size_t line_length, length, used, scanned, word_start, word_length;
 
-				*res = lr->buffor;
-				return 0;
-			}
+	line_length = strlen(line) + 1;
+	if (_lr_grow(&lr->docs, &lr->docs_capacity, line_length) == -1) {
+		goto error;
+	}
+	memcpy(lr->docs, line, line_length);
+	used = line_length;
 
-			fprintf(stderr, "%s\n", SYNTAX_ERROR_STR);
-			fflush(stderr);
-			ignore_command = 0;
-			finished_line = 1;
-			lr->offset -= line_end + 1;
-			memmove(lr->buffor, lr->buffor + line_end + 1, lr->offset);
-		} else {
-			EINTR_RETRY(read_bytes, read(STDIN_FILENO, lr->buffor + lr->offset, MAX_LINE_LENGTH + 1 - lr->offset));
-			if (read_bytes == -1) {
+	/* docs moves as it grows, so the line is only referred to by offsets */
+	scanned = 0;
+	while ((word = nextheredoc(lr->docs + scanned, &word_length)) != NULL) {
+		word_start = word - lr->docs;
+		scanned = word_start + word_length;
+		for (;;) {
+			if (_lr_next(lr, CONTINUATION_PROMPT_STR, &body) == -1) {
 				goto error;
 			}
-
-			lr->offset += read_bytes;
+			if (body == NULL) {
+				break;
+			}
+			length = strlen(body);
+			if (length == word_length && memcmp(body, lr->docs + word_start, length) == 0) {
+				break;
+			}
+			if (_lr_grow(&lr->docs, &lr->docs_capacity, used + length + 2) == -1) {
+				goto error;
+			}
+			memcpy(lr->docs + used, body, length);
+			lr->docs[used + length] = '\n';
+			used += length + 1;
 		}
+		if (_lr_grow(&lr->docs, &lr->docs_capacity, used + 1) == -1) {
+			goto error;
+		}
+		lr->docs[used++] = '\0';
 	}
 
-	*res = NULL;
+	lr->heredocs = lr->docs + line_length;
+	lr->heredocs_length = used - line_length;
+	return 0;
+error:
+	return -1;
+}
+
+int lr_readline(struct linereader * lr, char const** res) {
+	size_t length;
+
+	lr->heredocs = NULL;
+	lr->heredocs_length = 0;
+	if (_lr_next(lr, PROMPT_STR, res) == -1) {
+		goto error;
+	}
+	if (*res == NULL || nextheredoc(*res, &length) == NULL) {
+		return 0;
+	}
+	if (_lr_read_heredocs(lr, *res) == -1) {
+		goto error;
+	}
+	*res = lr->docs;
 	return 0;
 error:
 	return -1;
 }
 
 void lr_clean(struct linereader * lr) {
+	if (lr->map != NULL) {
+		_lr_unmap(lr);
+	}
 	free(lr->buffor);
+	free(lr->docs);
 }
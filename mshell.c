@@ -9,7 +9,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
-#include <assert.h>
+#include <signal.h>
+#include <time.h>
 
 #include "config.h"
 #include "siparse.h"
@@ -17,31 +18,57 @@
 #include "builtins.h"
 #include "linereader.h"
 #include "processgroups.h"
+#include "pathcache.h"
+#include "linecache.h"
+#include "trace.h"
+#include "rewrite.h"
+#include "pipesize.h"
+#include "substitution.h"
+#include "heredoc.h"
+#include "parallel.h"
+#include "coprocess.h"
+#include "argbatch.h"
+
+#if USE_POSIX_SPAWN && defined(_POSIX_SPAWN) && _POSIX_SPAWN > 0 && _POSIX_VERSION >= 200809L
+#define HAVE_SPAWN 1
+#include <spawn.h>
+
+extern char ** environ;
+#endif
 
 typedef struct child {
 	pid_t pid;
 	int return_status;
 } child;
 
-child * dead_children = NULL;
-int dead_children_size = 0;
-int dead_children_capacity = 0;
+/* Ring of finished background processes. The producer is dead_child, called
+   when a child is reaped, possibly from the SIGCHLD handler, the consumer is
+   the main loop. Only the producer moves the tail and only the consumer moves
+   the head, so it needs neither locks nor allocation. */
+static volatile child dead_children[DEAD_CHILDREN_RING_SIZE];
+static volatile sig_atomic_t dead_children_head = 0;
+static volatile sig_atomic_t dead_children_tail = 0;
+static volatile sig_atomic_t dead_children_lost = 0; /* records dropped on overflow */
 
 void dead_child(pid_t pid, int return_status) {
-	pg_block_sigchld();
+	int tail, next;
 
-	if (dead_children_size == dead_children_capacity) {
-		dead_children_capacity += dead_children_capacity / 2;
-		dead_children = (child *) realloc(dead_children, sizeof(child) * dead_children_capacity);
-		assert(dead_children != NULL); /* called from signal handler so no way to report error to main */
+	tail = dead_children_tail;
+	next = (tail + 1) % DEAD_CHILDREN_RING_SIZE;
+	if (next == dead_children_head) {
+		++dead_children_lost;
+		return;
 	}
-	dead_children[dead_children_size].pid = pid;
-	dead_children[dead_children_size].return_status = return_status;
-	++dead_children_size;
-
-	pg_unblock_sigchld();
+	dead_children[tail].pid = pid;
+	dead_children[tail].return_status = return_status;
+	dead_children_tail = next;
 }
 
+/* Set while a foreground pipeline starts whose stages get the terminal. The
+   first process of the group takes it at once, so a stage reading it right
+   away is not stopped by SIGTTIN before the shell calls pg_foreground. */
+static int start_in_foreground = 0;
+
 int redirect(const char * filename, int flags, int to_fd) {
 	int fd, fd_dup, result;
 
@@ -65,18 +92,252 @@ error:
 	return -1;
 }
 
-int exec_command(command * com, int in_fd, int out_fd, int pg_pid) {
+/* The last input redirection is either a file to open or the descriptor of
+   a here-document or here-string body, the other one is NULL or -1 */
+void find_redirections(command * com, char ** input_filename, int * input_fd, char ** output_filename, int * output_additional_flags) {
+	redirection ** redir;
+
+	*input_filename = NULL;
+	*input_fd = -1;
+	*output_filename = NULL;
+	*output_additional_flags = 0;
+
+	for (redir = com->redirs; *redir != NULL; ++redir) {
+		if (IS_RIN((*redir)->flags)) {
+			*input_filename = (*redir)->filename;
+			*input_fd = -1;
+		} else if (IS_RHEREDOC((*redir)->flags) || IS_RHERESTR((*redir)->flags)) {
+			*input_filename = NULL;
+			*input_fd = hd_fd(*redir);
+		} else if (IS_ROUT((*redir)->flags)) {
+			*output_filename = (*redir)->filename;
+			*output_additional_flags = O_TRUNC;
+		} else if (IS_RAPPEND((*redir)->flags)) {
+			*output_filename = (*redir)->filename;
+			*output_additional_flags = O_APPEND;
+		}
+	}
+}
+
+#ifdef HAVE_SPAWN
+/* Starts the command with posix_spawn, so the shell's page tables are never
+   copied. Returns -1 and sets errno on any failure, the caller falls back to
+   fork which then reports the error exactly like before. */
+pid_t spawn_command(command * com, const char * path, int in_fd, int out_fd, pid_t pg_pid) {
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t sigdefault, sigmask;
+	char * input_filename, * output_filename;
+	int input_fd, output_additional_flags;
+	pid_t child_pid;
+	int result;
+
+	if (path == NULL || pg_spawn_sigsets(&sigdefault, &sigmask) == -1) {
+		goto error;
+	}
+
+	if (posix_spawnattr_init(&attr) != 0) {
+		goto error;
+	}
+	if (posix_spawn_file_actions_init(&actions) != 0) {
+		goto error_attr;
+	}
+
+	result = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK)
+	  || posix_spawnattr_setpgroup(&attr, pg_pid)
+	  || posix_spawnattr_setsigdefault(&attr, &sigdefault)
+	  || posix_spawnattr_setsigmask(&attr, &sigmask);
+
+	if (!result && in_fd != STDIN_FILENO) {
+		result = posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	}
+	if (!result && out_fd != STDOUT_FILENO) {
+		result = posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+	}
+
+	find_redirections(com, &input_filename, &input_fd, &output_filename, &output_additional_flags);
+
+	if (!result && input_filename) {
+		result = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, input_filename,
+		    O_RDONLY, 0);
+	}
+	if (!result && input_fd != -1) {
+		result = posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+	}
+	if (!result && output_filename) {
+		result = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, output_filename,
+		    O_WRONLY | O_CREAT | output_additional_flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	}
+
+	if (!result && path == com->argv[0]) {
+		result = posix_spawnp(&child_pid, path, &actions, &attr, com->argv, environ);
+	} else if (!result) {
+		result = posix_spawn(&child_pid, path, &actions, &attr, com->argv, environ);
+	}
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (result) {
+		errno = result;
+		goto error;
+	}
+	return child_pid;
+
+error_attr:
+	posix_spawnattr_destroy(&attr);
+error:
+	return -1;
+}
+#endif
+
+/* Waits before retrying a fork that failed with EAGAIN, reaping children in
+   the meantime so they give their process slots back. Returns -1 when there
+   are no retries left. */
+int fork_backoff(int attempt) {
+	struct timespec delay;
+	long ms;
+
+	if (attempt >= FORK_RETRY_COUNT) {
+		return -1;
+	}
+	pg_reap();
+
+	ms = (long) FORK_RETRY_DELAY_MS << attempt;
+	delay.tv_sec = ms / 1000;
+	delay.tv_nsec = (ms % 1000) * 1000000L;
+	nanosleep(&delay, NULL); /* interrupted sleep is fine too */
+	return 0;
+}
+
+/* Runs a builtin in the shell process with its stdin and stdout replaced by
+   in_fd and out_fd and then by its redirections, exactly like a forked
+   child would set them up. The shell's own fds are saved close-on-exec and
+   restored afterwards. SIGPIPE is ignored meanwhile, so a builtin writing
+   to a pipe nobody reads gets EPIPE instead of killing the shell. Returns
+   -1 if the builtin could not be run. */
+int run_builtin(command * com, builtin_func builtin, int in_fd, int out_fd) {
+	struct sigaction sa, old_sa_pipe;
+	char * filenames[2];
+	int saved_fds[2], fds[2];
+	int i, argc, input_fd, output_additional_flags, result;
+
+	find_redirections(com, &filenames[0], &input_fd, &filenames[1], &output_additional_flags);
+	fds[0] = input_fd != -1 ? input_fd : in_fd;
+	fds[1] = out_fd;
+	result = -1;
+
+	saved_fds[0] = saved_fds[1] = -1;
+	fflush(stdout);
+	for (i = 0; i < 2; ++i) {
+		if (fds[i] == i && filenames[i] == NULL) {
+			continue;
+		}
+		saved_fds[i] = fcntl(i, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+		if (saved_fds[i] == -1) {
+			fprintf(stderr, "cannot save fd %d: %s\n", i, strerror(errno));
+			goto restore;
+		}
+		if (fds[i] != i) {
+			EINTR_RETRY(result, dup2(fds[i], i));
+			if (result == -1) {
+				fprintf(stderr, "dup2 failed to copy %d to %d\n", fds[i], i);
+				goto restore;
+			}
+		}
+	}
+
+	if ((filenames[0] && redirect(filenames[0], O_RDONLY, STDIN_FILENO) == -1)
+	  || (filenames[1] && redirect(filenames[1], O_WRONLY | O_CREAT | output_additional_flags, STDOUT_FILENO) == -1)) {
+		result = -1;
+		goto restore;
+	}
+
+	sa.sa_handler = SIG_IGN;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGPIPE, &sa, &old_sa_pipe);
+
+	for (argc = 0; com->argv[argc]; ++argc);
+	if (builtin(argc, com->argv) == BUILTIN_ERROR) {
+		fprintf(stderr, "Builtin %s error.\n", com->argv[0]);
+	}
+	fflush(stdout);
+	result = 0;
+
+	sigaction(SIGPIPE, &old_sa_pipe, NULL);
+restore:
+	fflush(stderr);
+	for (i = 0; i < 2; ++i) {
+		if (saved_fds[i] != -1) {
+			dup2(saved_fds[i], i);
+			close(saved_fds[i]);
+		}
+	}
+	return result;
+}
+
+/* Starts a child running com, or builtin when it is not NULL, with in_fd and
+   out_fd as stdin and stdout. pipe_fds are the count pipe ends the shell
+   holds, they are close-on-exec, but a forked builtin never execs so it
+   closes them itself to let its neighbours see EOF. The same goes for the
+   child running the batches of arguments too long for one exec. */
+int exec_command(command * com, builtin_func builtin, int in_fd, int out_fd, int pg_pid, int * pipe_fds, int count) {
 	pid_t child_pid;
 	char * input_filename, * output_filename;
-	int output_additional_flags;
-	redirection ** redir;
+	int input_fd, output_additional_flags;
 	int ret_fd;
+	const char * path;
+	int i, attempt, result, batches;
+	double start;
+	int trace_pipe[2];
+	sigset_t sigttou, sigmask;
+
+	start = tr_start();
+	trace_pipe[0] = trace_pipe[1] = -1;
+	if (tr_enabled && builtin == NULL) {
+		tr_exec_pipe(trace_pipe);
+	}
+
+	path = NULL;
+	batches = 0;
+	if (builtin != NULL) {
+		fflush(stdout); /* the child would write it once more */
+	} else {
+		path = pc_lookup(com->argv[0]);
+		batches = ab_needed(com->argv);
+	}
+
+#ifdef HAVE_SPAWN
+	child_pid = builtin == NULL && !batches ? spawn_command(com, path, in_fd, out_fd, pg_pid) : -1;
+	if (child_pid == -1 && builtin == NULL && !batches && path != NULL && path != com->argv[0]
+	  && (errno == ENOENT || errno == EACCES) && access(path, X_OK) == -1) {
+		/* the cached path went stale, resolve the name once more; a failed
+		   redirection gives the same errno but leaves the path executable */
+		pc_forget(com->argv[0]);
+		path = pc_lookup(com->argv[0]);
+		child_pid = spawn_command(com, path, in_fd, out_fd, pg_pid);
+	}
+	if (child_pid != -1) {
+		if (tr_enabled) {
+			tr_complete("spawn", start, child_pid, com->argv[0]);
+			tr_exec_wait(trace_pipe, child_pid, start, com->argv[0]);
+		}
+		return child_pid;
+	}
+#endif
 
-	child_pid = fork();
+	attempt = 0;
+	do {
+		child_pid = fork();
+	} while (child_pid == -1 && errno == EAGAIN && fork_backoff(attempt++) == 0);
 	if (child_pid == -1) {
 		goto error;
 	}
 	if (child_pid) { /* parent */
+		if (tr_enabled) {
+			tr_complete("fork", start, child_pid, com->argv[0]);
+			tr_exec_wait(trace_pipe, child_pid, start, com->argv[0]);
+		}
 		return child_pid;
 	} else { /* child */
 		pg_clean();
@@ -86,6 +347,13 @@ int exec_command(command * com, int in_fd, int out_fd, int pg_pid) {
 			fprintf(stderr, "cannot set pgid to %d: %s\n", pg_pid, strerror(errno));
 			goto child_error;
 		}
+		if (start_in_foreground && pg_pid == 0) {
+			sigemptyset(&sigttou);
+			sigaddset(&sigttou, SIGTTOU);
+			sigprocmask(SIG_BLOCK, &sigttou, &sigmask);
+			tcsetpgrp(STDIN_FILENO, getpid()); /* ignore errors */
+			sigprocmask(SIG_SETMASK, &sigmask, NULL);
+		}
 #else
 		if (setsid() == -1) {
 			fprintf(stderr, "setsid failed: %s\n", strerror(errno));
@@ -109,25 +377,20 @@ int exec_command(command * com, int in_fd, int out_fd, int pg_pid) {
 			}
 		}
 
-		input_filename = NULL;
-		output_filename = NULL;
-
-		for (redir = com->redirs; *redir != NULL; ++redir) {
-			if (IS_RIN((*redir)->flags)) {
-				input_filename = (*redir)->filename;
-			} else if (IS_ROUT((*redir)->flags)) {
-				output_filename = (*redir)->filename;
-				output_additional_flags = O_TRUNC;
-			} else if (IS_RAPPEND((*redir)->flags)) {
-				output_filename = (*redir)->filename;
-				output_additional_flags = O_APPEND;
-			}
-		}
+		find_redirections(com, &input_filename, &input_fd, &output_filename, &output_additional_flags);
 
 		if (input_filename && redirect(input_filename, O_RDONLY, STDIN_FILENO) == -1) {
 			goto child_error;
 		}
 
+		if (input_fd != -1) {
+			EINTR_RETRY(ret_fd, dup2(input_fd, STDIN_FILENO));
+			if (ret_fd != STDIN_FILENO) {
+				fprintf(stderr, "dup2 failed to copy %d to %d\n", input_fd, STDIN_FILENO);
+				goto child_error;
+			}
+		}
+
 		if (output_filename && redirect(output_filename, O_WRONLY | O_CREAT | output_additional_flags, STDOUT_FILENO) == -1) {
 			goto child_error;
 		}
@@ -138,17 +401,87 @@ int exec_command(command * com, int in_fd, int out_fd, int pg_pid) {
 			goto child_error;
 		}
 
+		if (builtin != NULL || batches) {
+			for (i = 0; i < count; ++i) {
+				if (pipe_fds[i] > STDERR_FILENO) {
+					EINTR_RETRY(result, close(pipe_fds[i]));
+				}
+			}
+			ps_unwatch_all();
+			sb_close_others(com);
+			co_close_fds();
+		}
+
+		if (builtin != NULL) {
+			for (i = 0; com->argv[i]; ++i);
+			result = builtin(i, com->argv);
+			if (result == BUILTIN_ERROR) {
+				fprintf(stderr, "Builtin %s error.\n", com->argv[0]);
+			}
+			fflush(stdout);
+			_exit(result);
+		}
+
+		if (batches) {
+			/* this child stays as the stage, the batches are its children */
+			if (trace_pipe[0] != -1) {
+				close(trace_pipe[0]);
+				close(trace_pipe[1]);
+			}
+			_exit(ab_run(com->argv, path));
+		}
+
+		if (path != NULL && path != com->argv[0]) {
+			execv(path, com->argv);
+		}
 		execvp(com->argv[0], com->argv);
 		fprintf(stderr, "%s: %s\n", com->argv[0], strerror(errno));
 		goto child_error;
 	}
 
 error:
+	if (tr_enabled) {
+		tr_exec_wait(trace_pipe, -1, start, NULL);
+	}
 	return -1;
 child_error:
+	if (tr_enabled) {
+		tr_exec_failed(trace_pipe);
+	}
 	exit(EXEC_FAILURE);
 }
 
+/* Starts argv like a single stage pipeline without redirections, for the
+   coprocess, co_start_func for co_set_start */
+pid_t start_job(char ** argv, int in_fd, int out_fd, pid_t pg_pid, int * shell_fds, int count) {
+	command com;
+	redirection * redirs[1];
+
+	redirs[0] = NULL;
+	com.argv = argv;
+	com.redirs = redirs;
+	com.pipesize = 0;
+	return exec_command(&com, get_builtin(argv[0]), in_fd, out_fd, pg_pid, shell_fds, count);
+}
+
+/* Starts a job of the parallel builtin, pj_start_func for pj_set_start */
+pid_t start_parallel_job(char ** argv, int in_fd, int out_fd, pid_t pg_pid) {
+	return start_job(argv, in_fd, out_fd, pg_pid, NULL, 0);
+}
+
+void close_in_shell_fds(int fds[2]) {
+	int result;
+
+	if (fds[0] != STDIN_FILENO) {
+		EINTR_RETRY(result, close(fds[0]));
+		fds[0] = STDIN_FILENO;
+	}
+	if (fds[1] != STDOUT_FILENO) {
+		EINTR_RETRY(result, close(fds[1]));
+		fds[1] = STDOUT_FILENO;
+	}
+}
+
 int close_pipe(int p[2]) {
 	int result;
 
@@ -169,31 +502,139 @@ error:
 	return -1;
 }
 
+int check_line(line * ln);
+
+typedef struct substitution_group {
+	int pgn;
+	int background;
+	int * pipe_fds;      /* of the pipeline the substitution belongs to */
+	int * in_shell_fds;
+} substitution_group;
+
+/* Starts the pipeline text of a process substitution in the group of the
+   pipeline it belongs to, builtins in it are forked. sb_start_func for
+   sb_expand. */
+int start_substitution(const char * text, int in_fd, int out_fd, void * data) {
+	substitution_group * group;
+	line * ln;
+	pipeline pl;
+	int i, p_tab[4], * p1, * p2, close_fds[10];
+	pid_t child_pid;
+
+	group = (substitution_group *) data;
+	p1 = p_tab;
+	p2 = p_tab + 2;
+	p1[0] = p2[0] = STDIN_FILENO;
+	p1[1] = p2[1] = STDOUT_FILENO;
+
+	ln = parselineowned(text);
+	if (!check_line(ln) || ln->pipelines[1] != NULL || (ln->flags & LINBACKGROUND)) {
+		fprintf(stderr, "%s\n", SYNTAX_ERROR_STR);
+		goto error;
+	}
+	if (hd_open(ln, NULL, 0) == -1) {
+		fprintf(stderr, "cannot open here-document: %s\n", strerror(errno));
+		goto error;
+	}
+
+	pl = ln->pipelines[0];
+	for (i = 0; pl[i] != NULL; ++i) {
+		swap_ptr((void **) &p1, (void **) &p2);
+		if (close_pipe(p2) == -1) {
+			goto error;
+		}
+		if (pl[i + 1] != NULL) {
+			if (pipe(p2) == -1
+			  || fcntl(p2[0], F_SETFD, FD_CLOEXEC) == -1
+			  || fcntl(p2[1], F_SETFD, FD_CLOEXEC) == -1) {
+				goto error;
+			}
+			ps_apply(p2[1], pl[i + 1]->pipesize);
+		}
+		if (pl[i]->argv[0] == NULL) {
+			continue;
+		}
+
+		memcpy(close_fds, p_tab, 4 * sizeof(int));
+		memcpy(close_fds + 4, group->pipe_fds, 4 * sizeof(int));
+		memcpy(close_fds + 8, group->in_shell_fds, 2 * sizeof(int));
+		child_pid = exec_command(pl[i], get_builtin(pl[i]->argv[0]), i == 0 ? in_fd : p1[0],
+		    pl[i + 1] == NULL ? out_fd : p2[1], pg_pid(group->pgn), close_fds, 10);
+		if (child_pid == -1) {
+			fprintf(stderr, "%s: cannot start: %s\n", pl[i]->argv[0], strerror(errno));
+			goto error;
+		}
+		if (pg_add_process(group->pgn, child_pid, group->background ? dead_child : ps_reaped) == -1) {
+			goto error;
+		}
+	}
+
+	close_pipe(p2);
+	close_pipe(p1);
+	hd_close(ln);
+	freeline(ln);
+	return 0;
+error:
+	fflush(stderr);
+	close_pipe(p2);
+	close_pipe(p1);
+	hd_close(ln);
+	freeline(ln);
+	return -1;
+}
+
+/* Runs a pipeline. A builtin as the last stage runs in the shell, after all
+   the other stages have started so the pipe into it is drained, and as the
+   last stage it can change the shell's state. Builtins in other stages, and
+   all of a background pipeline, are forked. */
 int exec_pipeline(pipeline pl, int background) {
 	command * com;
-	int i, argc, pl_len, pgn;
-	builtin_func builtin;
+	int i, pl_len, pgn, in_shell, reads_tty;
+	builtin_func builtin, in_shell_builtin;
 	pipeline tmp_pl;
 	pid_t child_pid;
 	int p_tab[4];
 	int * p1, * p2;
+	int in_shell_fds[2];
+	command * expanded, * in_shell_com, * in_shell_expanded;
+	substitution_group group;
 
 	p1 = p_tab;
 	p2 = p_tab + 2;
 	p1[0] = p2[0] = STDIN_FILENO;
 	p1[1] = p2[1] = STDOUT_FILENO;
 
-	pl_len = 0;
-	for (tmp_pl = pl; *tmp_pl != NULL; ++tmp_pl) {
-		++pl_len;
+	for (pl_len = 0, tmp_pl = pl; *tmp_pl != NULL; ++tmp_pl, ++pl_len);
+	in_shell = -1;
+	in_shell_builtin = NULL;
+	if (pl_len > 0 && pl[pl_len - 1]->argv[0] != NULL && (!background || pl_len == 1)) {
+		in_shell_builtin = get_builtin(pl[pl_len - 1]->argv[0]);
+		if (in_shell_builtin != NULL) {
+			in_shell = pl_len - 1;
+		}
+	}
+	in_shell_fds[0] = STDIN_FILENO;
+	in_shell_fds[1] = STDOUT_FILENO;
+	in_shell_com = in_shell_expanded = NULL;
+
+	if (background) {
+		/* the shell's own input is the queue of waiting jobs */
+		pg_wait_background_slot();
 	}
 
 	pgn = pg_new(NULL);
 	if (pgn == -1) {
 		goto error;
 	}
+	pg_set_background(pgn, background);
+	group.pgn = pgn;
+	group.background = background;
+	group.pipe_fds = p_tab;
+	group.in_shell_fds = in_shell_fds;
 
 	pg_block_sigchld();
+	/* not when a builtin run in the shell reads the terminal */
+	start_in_foreground = !background && in_shell != 0;
 	for (i = 0; i < pl_len; ++i) {
 		swap_ptr((void **) &p1, (void **) &p2);
 		if (close_pipe(p2) == -1) {
@@ -205,6 +646,7 @@ int exec_pipeline(pipeline pl, int background) {
 			  || fcntl(p2[1], F_SETFD, FD_CLOEXEC) == -1) {
 				goto error;
 			}
+			ps_apply(p2[1], pl[i + 1]->pipesize); /* best effort */
 		}
 
 		com = pl[i];
@@ -213,38 +655,96 @@ int exec_pipeline(pipeline pl, int background) {
 			continue;
 		}
 
-		builtin = get_builtin(com->argv[0]);
-		if (builtin && pl_len < 2) {
-			for (argc = 0; com->argv[argc]; ++argc);
-			if (builtin(argc, com->argv) == BUILTIN_ERROR) {
-				fprintf(stderr, "Builtin %s error.\n", com->argv[0]);
+		/* substitutions start first, in the same group; the shell keeps the
+		   stage's ends of their pipes until it runs */
+		expanded = NULL;
+		if (sb_has(com)) {
+			expanded = sb_expand(com, start_substitution, &group);
+			if (expanded == NULL) {
+				fprintf(stderr, "%s: cannot start substitution\n", com->argv[0]);
 				fflush(stderr);
+				close_in_shell_fds(in_shell_fds);
+				in_shell = -1;
+				break;
+			}
+			com = expanded;
+		}
+
+		if (i == in_shell) {
+			/* keep the stage's ends of the pipes until the other stages run */
+			in_shell_com = com;
+			in_shell_expanded = expanded;
+			if ((p1[0] != STDIN_FILENO && (in_shell_fds[0] = fcntl(p1[0], F_DUPFD_CLOEXEC, STDERR_FILENO + 1)) == -1)
+			  || (p2[1] != STDOUT_FILENO && (in_shell_fds[1] = fcntl(p2[1], F_DUPFD_CLOEXEC, STDERR_FILENO + 1)) == -1)) {
+				goto error;
 			}
 		} else {
-			child_pid = exec_command(com, p1[0], p2[1], pg_pid(pgn));
+			builtin = get_builtin(com->argv[0]);
+			child_pid = expanded != NULL && sb_inherit(expanded) == -1 ? -1
+			  : exec_command(com, builtin, p1[0], p2[1], pg_pid(pgn), p_tab, 4);
+			sb_free(expanded);
 			if (child_pid == -1) {
-				goto error;
+				/* give up on this pipeline only, started stages get EOF or
+				   SIGPIPE once the pipes are closed */
+				fprintf(stderr, "%s: cannot start: %s\n", com->argv[0], strerror(errno));
+				fflush(stderr);
+				close_in_shell_fds(in_shell_fds);
+				in_shell = -1;
+				break;
 			}
-			if (pg_add_process(pgn, child_pid, background ? dead_child : NULL) == -1) {
+			if (pg_add_process(pgn, child_pid, background ? dead_child : ps_reaped) == -1) {
 				goto error;
 			}
+			/* a pipe after the stage run in the shell can't be watched: the
+			   copy kept by the shell would let that stage block forever on a
+			   full pipe whose reader is gone, with nobody left to reap it */
+			if (!background && ps_adaptive() && p1[0] != STDIN_FILENO && com->pipesize == 0
+			  && (in_shell == -1 || i < in_shell)) {
+				ps_watch(p1[0], child_pid);
+			}
 		}
 	}
 
+	start_in_foreground = 0;
 	if (close_pipe(p2) == -1
 	  || close_pipe(p1) == -1) {
 		goto error;
 	}
 
-	if (!background) {
+	/* a builtin reading the shell's stdin, i.e. a single stage, keeps the
+	   terminal while it runs; one reading a pipe leaves it to the stages */
+	reads_tty = in_shell != -1 && in_shell_fds[0] == STDIN_FILENO;
+	if (!background && !reads_tty) {
 		pg_foreground(pgn);
-		pg_wait(pgn);
+	}
+	if (in_shell != -1) {
+		run_builtin(in_shell_com, in_shell_builtin, in_shell_fds[0], in_shell_fds[1]);
+		close_in_shell_fds(in_shell_fds);
+	}
+	sb_free(in_shell_expanded);
+	if (!background) {
+		if (reads_tty) {
+			pg_foreground(pgn);
+		}
+		if (ps_watching()) {
+			pg_wait_polling(pgn, PIPE_ADAPT_INTERVAL_MS, ps_adapt);
+			ps_unwatch_all();
+		} else {
+			pg_wait(pgn);
+		}
 		pg_foreground(0);
 	}
+	if (!pg_running(pgn)) {
+		pg_del(pgn); /* finished groups and those made only of builtins */
+	}
 
 	pg_unblock_sigchld();
 	return 0;
 error:
+	start_in_foreground = 0;
+	close_in_shell_fds(in_shell_fds);
+	sb_free(in_shell_expanded);
+	ps_unwatch_all();
 	pg_unblock_sigchld();
 	return -1;
 }
@@ -276,14 +776,43 @@ int check_line(line * ln) {
 	return 1;
 }
 
-int exec_command_line(const char * buffor) {
+/* Runs a line read by lr_readline, heredocs being the bodies of its
+   here-documents */
+int exec_command_line(const char * buffor, const char * heredocs, size_t heredocs_length) {
 	line * ln;
 	pipeline * cl;
+	lc_entry * cached;
+	double start;
+
+	start = tr_start();
+	cached = lc_take(buffor);
+	if (cached == NULL) {
+		ln = parselineowned(buffor);
+		if (tr_enabled) {
+			tr_complete("parse", start, 0, NULL);
+		}
+		if (!check_line(ln)) {
+			freeline(ln);
+			fprintf(stderr, "%s\n", SYNTAX_ERROR_STR);
+			fflush(stderr);
+			return 0;
+		}
+		if (rw_line(ln) == -1) {
+			freeline(ln);
+			return -1;
+		}
+		cached = lc_new(buffor, ln);
+		if (cached == NULL) {
+			freeline(ln);
+			return -1;
+		}
+	}
+	ln = lc_line(cached);
 
-	ln = parseline(buffor);
-	if (!check_line(ln)) {
-		fprintf(stderr, "%s\n", SYNTAX_ERROR_STR);
+	if (hd_open(ln, heredocs, heredocs_length) == -1) {
+		fprintf(stderr, "cannot open here-document: %s\n", strerror(errno));
 		fflush(stderr);
+		lc_put(cached);
 		return 0;
 	}
 
@@ -293,20 +822,27 @@ int exec_command_line(const char * buffor) {
 		}
 	}
 
+	hd_close(ln);
+	lc_put(cached);
 	return 0;
 error:
+	hd_close(ln);
+	lc_put(cached);
 	return -1;
 }
 
-void print_dead_childred() {
-	int i, rs;
+void drain_dead_children(int print) {
+	static int reported_lost = 0;
+	int head, rs, lost;
 
-	pg_block_sigchld();
-
-	for (i = 0; i < dead_children_size; ++i) {
-		rs = dead_children[i].return_status;
+	for (head = dead_children_head; head != dead_children_tail;
+	  head = (head + 1) % DEAD_CHILDREN_RING_SIZE) {
+		if (!print) {
+			continue;
+		}
+		rs = dead_children[head].return_status;
 
-		printf("Background process %d terminated. ", dead_children[i].pid);
+		printf("Background process %d terminated. ", dead_children[head].pid);
 
 		if (WIFEXITED(rs)) {
 			printf("(exited with status %d)\n", WEXITSTATUS(rs));
@@ -314,20 +850,23 @@ void print_dead_childred() {
 			printf("(killed by signal %d)\n", WTERMSIG(rs));
 		}
 	}
+	dead_children_head = head;
 
-	dead_children_size = 0;
-
-	pg_unblock_sigchld();
+	lost = dead_children_lost;
+	if (print && lost != reported_lost) {
+		printf("%d more background processes terminated.\n", lost - reported_lost);
+	}
+	reported_lost = lost;
 }
 
 int main(int argc, char * argv[]) {
 	const char * line;
 	int result;
 	struct linereader lr;
+	double start;
 
-	dead_children_capacity = 50;
-	dead_children = (child *) malloc(sizeof(child) * dead_children_capacity);
-	if (dead_children == NULL) {
+	result = tr_init(getenv(TRACE_ENV));
+	if (result == -1) {
 		goto error;
 	}
 
@@ -340,17 +879,26 @@ int main(int argc, char * argv[]) {
 	if (result == -1) {
 		goto error;
 	}
+	lr.wait_input = pg_wait_fd;
+	pj_set_start(start_parallel_job);
+	co_set_start(start_job, dead_child);
+
+	if (getenv(MAX_JOBS_ENV) != NULL) {
+		pg_set_max_background(atoi(getenv(MAX_JOBS_ENV)));
+	}
 
 	do {
-		if (lr.print_prompt) {
-			print_dead_childred();
-		}
+		drain_dead_children(lr.print_prompt);
+		start = tr_start();
 		result = lr_readline(&lr, &line);
+		if (tr_enabled) {
+			tr_complete("readline", start, 0, NULL);
+		}
 		if (result == -1) {
 			goto error;
 		}
 		if (line != NULL) {
-			result = exec_command_line(line);
+			result = exec_command_line(line, lr.heredocs, lr.heredocs_length);
 			if (result == -1) {
 				goto error;
 			}
@@ -358,11 +906,13 @@ int main(int argc, char * argv[]) {
 	} while (line != NULL);
 
 	pg_clean();
+	pc_clear();
+	lc_clear();
+	builtins_clean();
 	lr_clean(&lr);
 	return 0;
 
 error:
-	free(dead_children);
 	pg_clean();
 	lr_clean(&lr);
 	perror("main: ");
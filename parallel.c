@@ -0,0 +1,512 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "config.h"
+#include "utils.h"
+#include "processgroups.h"
+#include "parallel.h"
+
+#define PJ_PLACEHOLDER "{}"
+
+typedef struct pj_output {
+	char * data;
+	size_t length;
+	size_t capacity;
+} pj_output;
+
+typedef struct pj_job {
+	long seq;          /* index of the item, -1 for a free slot */
+	int pgn;
+	pid_t pid;
+	int fd;            /* read end of the job's stdout, -1 at its end */
+	int reaped;        /* the job is done at the end of its stdout once reaped */
+	int return_status; /* set when the job is reaped */
+	pj_output output;
+} pj_job;
+
+/* Output of a job finished before the ones of earlier items */
+typedef struct pj_pending {
+	int done;
+	pj_output output;
+} pj_pending;
+
+/* Lines of stdin read ahead */
+typedef struct pj_reader {
+	char * data;
+	size_t start;
+	size_t end;
+	size_t capacity;
+	int eof;
+} pj_reader;
+
+static pj_start_func start_job = NULL;
+static pj_job * jobs = NULL;
+static int jobs_count = 0;
+
+/* Wakes up the poll loop from signal handlers */
+static int wake_pipe[2] = {-1, -1};
+static volatile sig_atomic_t interrupted = 0;
+
+void pj_set_start(pj_start_func start) {
+	start_job = start;
+}
+
+static int _pj_grow(char ** data, size_t * capacity, size_t size) {
+	size_t new_capacity;
+	char * grown;
+
+	if (size <= *capacity) {
+		return 0;
+	}
+	new_capacity = *capacity ? *capacity : PARALLEL_BUFFER_SIZE;
+	for (; new_capacity < size; new_capacity *= 2);
+	grown = realloc(*data, new_capacity);
+	if (grown == NULL) {
+		return -1;
+	}
+	*data = grown;
+	*capacity = new_capacity;
+	return 0;
+}
+
+/* Returns the next line of stdin without its newline, valid until the next
+   call, or NULL at the end */
+static char * _pj_read_item(pj_reader * r) {
+	char * line, * newline;
+	ssize_t result;
+
+	for (;;) {
+		line = r->data + r->start;
+		newline = r->start < r->end ? memchr(line, '\n', r->end - r->start) : NULL;
+		if (newline != NULL) {
+			*newline = '\0';
+			r->start = newline - r->data + 1;
+			return line;
+		}
+		if (r->eof) {
+			if (r->start == r->end) {
+				return NULL;
+			}
+			r->data[r->end] = '\0'; /* last line without a newline */
+			r->start = r->end;
+			return line;
+		}
+		if (r->start > 0) {
+			r->end -= r->start;
+			memmove(r->data, r->data + r->start, r->end);
+			r->start = 0;
+		}
+		if (_pj_grow(&r->data, &r->capacity, r->end + PARALLEL_BUFFER_SIZE / 4 + 1) == -1) {
+			return NULL;
+		}
+		do {
+			result = read(STDIN_FILENO, r->data + r->end, r->capacity - r->end - 1);
+		} while (result == -1 && errno == EINTR && !interrupted);
+		if (result <= 0) {
+			r->eof = 1;
+		} else {
+			r->end += result;
+		}
+	}
+}
+
+/* Returns the template's arguments for item in one allocated block */
+static char ** _pj_argv(char ** template, const char * item) {
+	char ** argv, * dest;
+	const char * src, * found;
+	size_t size, item_length;
+	int argc, i, placeholders;
+
+	item_length = strlen(item);
+	placeholders = 0;
+	size = 0;
+	for (argc = 0; template[argc] != NULL; ++argc) {
+		size += strlen(template[argc]) + 1;
+		for (src = template[argc]; (found = strstr(src, PJ_PLACEHOLDER)) != NULL; src = found + 2) {
+			size += item_length;
+			++placeholders;
+		}
+	}
+	if (placeholders == 0) {
+		size += item_length + 1;
+	}
+
+	argv = malloc((argc + 2) * sizeof(char *) + size);
+	if (argv == NULL) {
+		return NULL;
+	}
+	dest = (char *) (argv + argc + 2);
+	for (i = 0; i < argc; ++i) {
+		argv[i] = dest;
+		for (src = template[i]; (found = strstr(src, PJ_PLACEHOLDER)) != NULL; src = found + 2) {
+			memcpy(dest, src, found - src);
+			dest += found - src;
+			memcpy(dest, item, item_length);
+			dest += item_length;
+		}
+		strcpy(dest, src);
+		dest += strlen(src) + 1;
+	}
+	if (placeholders == 0) {
+		argv[argc++] = dest;
+		strcpy(dest, item);
+	}
+	argv[argc] = NULL;
+	return argv;
+}
+
+static void _pj_wake() {
+	int saved_errno, result;
+
+	saved_errno = errno;
+	result = write(wake_pipe[1], "", 1); /* a full pipe wakes up as well */
+	(void) result;
+	errno = saved_errno;
+}
+
+/* pg_add_process callback, may run in the SIGCHLD handler */
+static void _pj_reaped(pid_t pid, int return_status) {
+	int i;
+
+	for (i = 0; i < jobs_count; ++i) {
+		if (jobs[i].seq != -1 && jobs[i].pid == pid) {
+			jobs[i].return_status = return_status;
+			jobs[i].reaped = 1;
+		}
+	}
+	_pj_wake();
+}
+
+/* The jobs run in their own process groups, out of reach of the terminal's
+   SIGINT */
+static void _pj_sigint(int signo) {
+	interrupted = 1;
+	_pj_wake();
+}
+
+static int _pj_start(pj_job * job, char ** template, const char * item, int in_fd) {
+	char ** argv;
+	int p[2], result;
+
+	argv = _pj_argv(template, item);
+	if (argv == NULL) {
+		return -1;
+	}
+	if (pipe(p) == -1) {
+		free(argv);
+		return -1;
+	}
+	if (fcntl(p[0], F_SETFD, FD_CLOEXEC) == -1
+	  || fcntl(p[1], F_SETFD, FD_CLOEXEC) == -1) {
+		goto error;
+	}
+
+	pg_block_sigchld();
+	job->pgn = pg_new(NULL);
+	if (job->pgn == -1) {
+		pg_unblock_sigchld();
+		goto error;
+	}
+	job->return_status = 0;
+	job->reaped = 0;
+	job->pid = start_job(argv, in_fd, p[1], pg_pid(job->pgn));
+	if (job->pid == -1 || pg_add_process(job->pgn, job->pid, _pj_reaped) == -1) {
+		pg_del(job->pgn);
+		pg_unblock_sigchld();
+		goto error;
+	}
+	pg_unblock_sigchld();
+
+	EINTR_RETRY(result, close(p[1]));
+	job->fd = p[0];
+	job->output.length = 0;
+	free(argv);
+	return 0;
+error:
+	EINTR_RETRY(result, close(p[0]));
+	EINTR_RETRY(result, close(p[1]));
+	free(argv);
+	return -1;
+}
+
+static int _pj_write(pj_output * output) {
+	const char * data;
+	size_t length;
+	ssize_t result;
+
+	data = output->data;
+	for (length = output->length; length > 0; data += result, length -= result) {
+		EINTR_RETRY(result, write(STDOUT_FILENO, data, length));
+		if (result == -1) {
+			return -1;
+		}
+	}
+	output->length = 0;
+	return 0;
+}
+
+/* Moves the output of the finished job at seq to the pending ring, growing
+   it so it holds every item from the first one not written yet */
+static int _pj_keep(pj_pending ** ring, long * capacity, long first, long seq, pj_output * output) {
+	pj_pending * grown;
+	long new_capacity, i;
+
+	if (seq - first >= *capacity) {
+		for (new_capacity = *capacity ? *capacity : 16; seq - first >= new_capacity; new_capacity *= 2);
+		grown = calloc(new_capacity, sizeof(pj_pending));
+		if (grown == NULL) {
+			return -1;
+		}
+		for (i = first; i < first + *capacity; ++i) {
+			grown[i % new_capacity] = (*ring)[i % *capacity];
+		}
+		free(*ring);
+		*ring = grown;
+		*capacity = new_capacity;
+	}
+	(*ring)[seq % *capacity].done = 1;
+	(*ring)[seq % *capacity].output = *output;
+	output->data = NULL;
+	output->length = output->capacity = 0;
+	return 0;
+}
+
+/* Writes the output of the job finished at the end of its stdout and frees
+   its slot, call with SIGCHLD blocked */
+static int _pj_finish(pj_job * job, int keep_order, pj_pending ** ring, long * ring_capacity, long * first, int * write_error) {
+	pj_pending * pending;
+
+	if (!keep_order || job->seq == *first) {
+		*write_error = *write_error || _pj_write(&job->output) == -1;
+		if (keep_order) {
+			++*first;
+		}
+	} else if (_pj_keep(ring, ring_capacity, *first, job->seq, &job->output) == -1) {
+		return -1;
+	}
+	job->seq = -1;
+
+	/* and the ones waiting for it */
+	while (keep_order && *ring_capacity > 0 && (pending = &(*ring)[*first % *ring_capacity])->done) {
+		*write_error = *write_error || _pj_write(&pending->output) == -1;
+		free(pending->output.data);
+		pending->output.data = NULL;
+		pending->done = 0;
+		++*first;
+	}
+	return 0;
+}
+
+int pj_run(char ** template, char ** items, int jobs_max, int keep_order) {
+	pj_reader reader;
+	pj_pending * ring;
+	struct pollfd * fds;
+	struct sigaction sa, old_sa_int;
+	char * item, drain[64];
+	long seq, first, ring_capacity;
+	int i, n, running, failed, more, in_fd, write_error, result, close_result, own_groups, sigint_set;
+	ssize_t read_bytes;
+	pj_job * job;
+
+	if (start_job == NULL || jobs_max <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	/* run as a forked builtin, the children are ours to reap */
+	own_groups = !pg_initialized();
+	if (own_groups && pg_init() == -1) {
+		return -1;
+	}
+	memset(&reader, 0, sizeof(reader));
+	ring = NULL;
+	ring_capacity = 0;
+	seq = first = 0;
+	running = failed = write_error = sigint_set = 0;
+	more = 1;
+	in_fd = STDIN_FILENO;
+	interrupted = 0;
+	result = -1;
+
+	jobs = calloc(jobs_max, sizeof(pj_job));
+	/* the job fds, the wake pipe and the one for pg_poll */
+	fds = calloc(jobs_max + 2, sizeof(struct pollfd));
+	if (jobs == NULL || fds == NULL) {
+		goto out;
+	}
+	for (i = 0; i < jobs_max; ++i) {
+		jobs[i].seq = -1;
+		jobs[i].fd = -1;
+	}
+	jobs_count = jobs_max;
+
+	if (pipe(wake_pipe) == -1) {
+		wake_pipe[0] = wake_pipe[1] = -1;
+		goto out;
+	}
+	for (i = 0; i < 2; ++i) {
+		if (fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC) == -1
+		  || fcntl(wake_pipe[i], F_SETFL, O_NONBLOCK) == -1) {
+			goto out;
+		}
+	}
+	sa.sa_handler = _pj_sigint;
+	sa.sa_flags = 0;
+	if (sigemptyset(&sa.sa_mask) == -1 || sigaction(SIGINT, &sa, &old_sa_int) == -1) {
+		goto out;
+	}
+	sigint_set = 1;
+
+	/* jobs must not take the items meant for the next jobs, nor read the
+	   terminal from a background group */
+	if (items == NULL || isatty(STDIN_FILENO)) {
+		EINTR_RETRY(in_fd, open("/dev/null", O_RDONLY));
+		if (in_fd == -1 || fcntl(in_fd, F_SETFD, FD_CLOEXEC) == -1) {
+			goto out;
+		}
+	}
+	fflush(stdout);
+
+	for (;;) {
+		/* fill the free slots */
+		while (more && !interrupted && running < jobs_max) {
+			item = items != NULL ? *items : _pj_read_item(&reader);
+			if (item == NULL) {
+				more = 0;
+				break;
+			}
+			if (items != NULL) {
+				++items;
+			}
+			for (i = 0; jobs[i].seq != -1; ++i);
+			jobs[i].seq = seq; /* before it can be reaped */
+			if (_pj_start(&jobs[i], template, item, in_fd) == -1) {
+				fprintf(stderr, "parallel: %s: cannot start: %s\n", template[0], strerror(errno));
+				jobs[i].seq = -1;
+				++failed;
+				continue;
+			}
+			++seq;
+			++running;
+		}
+		if (running == 0) {
+			break;
+		}
+
+		n = 0;
+		for (i = 0; i < jobs_max; ++i) {
+			if (jobs[i].seq != -1 && jobs[i].fd != -1) {
+				fds[n].fd = jobs[i].fd;
+				fds[n].events = POLLIN;
+				++n;
+			}
+		}
+		fds[n].fd = wake_pipe[0];
+		fds[n].events = POLLIN;
+		if (pg_poll(fds, n + 1) == -1) {
+			if (errno != EINTR) {
+				goto out;
+			}
+			memset(fds, 0, (n + 1) * sizeof(struct pollfd));
+		}
+		if (fds[n].revents) {
+			while (read(wake_pipe[0], drain, sizeof(drain)) > 0);
+		}
+
+		if (interrupted) {
+			interrupted = 0;
+			more = 0;
+			pg_block_sigchld();
+			for (i = 0; i < jobs_max; ++i) {
+				if (jobs[i].seq != -1 && !jobs[i].reaped) {
+					pg_kill(jobs[i].pgn, SIGINT);
+				}
+			}
+			pg_unblock_sigchld();
+		}
+
+		for (i = 0, n = 0; i < jobs_max; ++i) {
+			job = &jobs[i];
+			if (job->seq == -1 || job->fd == -1 || fds[n++].revents == 0) {
+				continue;
+			}
+			if (_pj_grow(&job->output.data, &job->output.capacity, job->output.length + PARALLEL_BUFFER_SIZE / 4) == -1) {
+				goto out;
+			}
+			EINTR_RETRY(read_bytes, read(job->fd, job->output.data + job->output.length,
+			    job->output.capacity - job->output.length));
+			if (read_bytes > 0) {
+				job->output.length += read_bytes;
+			} else {
+				EINTR_RETRY(close_result, close(job->fd));
+				job->fd = -1;
+			}
+		}
+
+		/* the jobs at the end of their output are done once reaped */
+		pg_block_sigchld();
+		for (i = 0; i < jobs_max; ++i) {
+			job = &jobs[i];
+			if (job->seq == -1 || job->fd != -1 || !job->reaped) {
+				continue;
+			}
+			if (!WIFEXITED(job->return_status) || WEXITSTATUS(job->return_status) != 0) {
+				++failed;
+			}
+			if (_pj_finish(job, keep_order, &ring, &ring_capacity, &first, &write_error) == -1) {
+				pg_unblock_sigchld();
+				goto out;
+			}
+			--running;
+		}
+		pg_unblock_sigchld();
+	}
+	result = write_error ? -1 : failed;
+
+out:
+	if (in_fd != STDIN_FILENO && in_fd != -1) {
+		close(in_fd);
+	}
+	for (i = 0; i < jobs_count; ++i) {
+		if (jobs[i].seq != -1) {
+			if (jobs[i].fd != -1) {
+				close(jobs[i].fd);
+			}
+			if (!jobs[i].reaped) {
+				pg_wait(jobs[i].pgn);
+			}
+		}
+		free(jobs[i].output.data);
+	}
+	for (i = 0; i < ring_capacity; ++i) {
+		free(ring[i].output.data);
+	}
+	if (sigint_set) {
+		sigaction(SIGINT, &old_sa_int, NULL); /* ignore errors */
+	}
+	for (i = 0; i < 2; ++i) {
+		if (wake_pipe[i] != -1) {
+			close(wake_pipe[i]);
+			wake_pipe[i] = -1;
+		}
+	}
+	jobs_count = 0;
+	free(ring);
+	free(fds);
+	free(jobs);
+	free(reader.data);
+	jobs = NULL;
+	if (own_groups) {
+		pg_clean();
+	}
+	return result;
+}
@@ -0,0 +1,176 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "utils.h"
+#include "pathcache.h"
+
+#define PC_BUCKETS 64 /* power of two */
+#define PC_DEFAULT_PATH "/bin:/usr/bin"
+
+typedef struct pc_entry {
+	char * name;
+	char * path;          /* NULL for commands not found */
+	time_t resolved;
+	int hits;
+	struct pc_entry * next;
+} pc_entry;
+
+static pc_entry * buckets[PC_BUCKETS];
+static char * cached_path_env = NULL; /* PATH the entries were resolved with */
+
+static void _pc_free_entry(pc_entry * e) {
+	free(e->name);
+	free(e->path);
+	free(e);
+}
+
+void pc_clear() {
+	int i;
+	pc_entry * e, * next;
+
+	for (i = 0; i < PC_BUCKETS; ++i) {
+		for (e = buckets[i]; e != NULL; e = next) {
+			next = e->next;
+			_pc_free_entry(e);
+		}
+		buckets[i] = NULL;
+	}
+	free(cached_path_env);
+	cached_path_env = NULL;
+}
+
+static int _pc_executable(const char * path) {
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+/* Searches PATH for name. Returns 1 and sets *result (malloced, NULL when not
+   found) or returns 0 if the answer depends on the working directory. */
+static int _pc_resolve(const char * path_env, const char * name, char ** result) {
+	const char * dir, * end;
+	size_t dir_len, name_len;
+	char * candidate;
+
+	*result = NULL;
+	name_len = strlen(name);
+
+	for (dir = path_env; ; dir = end + 1) {
+		end = strchr(dir, ':');
+		if (end == NULL) {
+			end = dir + strlen(dir);
+		}
+		dir_len = end - dir;
+
+		if (dir_len == 0 || *dir != '/') {
+			return 0;
+		}
+
+		candidate = malloc(dir_len + name_len + 2);
+		if (candidate == NULL) {
+			return 0;
+		}
+		memcpy(candidate, dir, dir_len);
+		candidate[dir_len] = '/';
+		memcpy(candidate + dir_len + 1, name, name_len + 1);
+
+		if (_pc_executable(candidate)) {
+			*result = candidate;
+			return 1;
+		}
+		free(candidate);
+
+		if (*end == '\0') {
+			break;
+		}
+	}
+	return 1;
+}
+
+const char * pc_lookup(const char * name) {
+	const char * path_env;
+	pc_entry * e, ** prev;
+	unsigned long bucket;
+	char * path;
+
+	if (*name == '\0' || strchr(name, '/') != NULL) {
+		return name;
+	}
+
+	path_env = getenv("PATH");
+	if (path_env == NULL) {
+		path_env = PC_DEFAULT_PATH;
+	}
+	if (cached_path_env == NULL || strcmp(cached_path_env, path_env) != 0) {
+		pc_clear();
+		cached_path_env = strdup(path_env);
+		if (cached_path_env == NULL) {
+			return name;
+		}
+	}
+
+	bucket = hash_str(name) & (PC_BUCKETS - 1);
+	for (prev = &buckets[bucket]; (e = *prev) != NULL; prev = &e->next) {
+		if (strcmp(e->name, name) == 0) {
+			break;
+		}
+	}
+
+	if (e != NULL) {
+		/* a found path is trusted until pc_forget, no syscall per hit */
+		if (e->path != NULL || time(NULL) - e->resolved < PATH_CACHE_NEGATIVE_TTL) {
+			++e->hits;
+			return e->path;
+		}
+		/* negative entry expired */
+		*prev = e->next;
+		_pc_free_entry(e);
+	}
+
+	if (!_pc_resolve(path_env, name, &path)) {
+		return name;
+	}
+
+	e = malloc(sizeof(pc_entry));
+	if (e == NULL || (e->name = strdup(name)) == NULL) {
+		free(e);
+		free(path);
+		return name;
+	}
+	e->path = path;
+	e->resolved = time(NULL);
+	e->hits = 1;
+	e->next = buckets[bucket];
+	buckets[bucket] = e;
+
+	return e->path;
+}
+
+void pc_forget(const char * name) {
+	pc_entry * e, ** prev;
+
+	for (prev = &buckets[hash_str(name) & (PC_BUCKETS - 1)]; (e = *prev) != NULL; prev = &e->next) {
+		if (strcmp(e->name, name) == 0) {
+			*prev = e->next;
+			_pc_free_entry(e);
+			return;
+		}
+	}
+}
+
+void pc_foreach(void (*f)(const char * name, const char * path, int hits)) {
+	int i;
+	pc_entry * e;
+
+	for (i = 0; i < PC_BUCKETS; ++i) {
+		for (e = buckets[i]; e != NULL; e = e->next) {
+			f(e->name, e->path, e->hits);
+		}
+	}
+}
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE /* F_SETPIPE_SZ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+
+#include "config.h"
+#include "utils.h"
+#include "pipesize.h"
+
+#if defined(F_SETPIPE_SZ) && defined(F_GETPIPE_SZ) && defined(FIONREAD)
+#define HAVE_PIPE_SIZE 1
+#endif
+
+#define PS_MAX_SIZE_FILE "/proc/sys/fs/pipe-max-size"
+#define PS_MAX_SIZE_FALLBACK (1 << 20)
+
+typedef struct watch {
+	int fd;          /* -1 for a free slot */
+	pid_t reader;
+} watch;
+
+static int session = PS_DEFAULT;
+static watch * watches = NULL;
+static int watches_count = 0;    /* used slots, some may be free again */
+static int watches_capacity = 0;
+
+void ps_set_session(int size) {
+	session = size;
+}
+
+int ps_session() {
+	return session;
+}
+
+#ifdef HAVE_PIPE_SIZE
+
+int ps_max_size() {
+	static int max = 0;
+	char buffer[32];
+	ssize_t length;
+	int fd, result;
+
+	if (max != 0) {
+		return max;
+	}
+	max = PS_MAX_SIZE_FALLBACK;
+	EINTR_RETRY(fd, open(PS_MAX_SIZE_FILE, O_RDONLY | O_CLOEXEC));
+	if (fd != -1) {
+		EINTR_RETRY(length, read(fd, buffer, sizeof(buffer) - 1));
+		if (length > 0) {
+			buffer[length] = '\0';
+			max = atoi(buffer);
+		}
+		EINTR_RETRY(result, close(fd));
+	}
+	if (max <= 0 || max > MAX_PIPE_SIZE) {
+		max = max <= 0 ? PS_MAX_SIZE_FALLBACK : MAX_PIPE_SIZE;
+	}
+	return max;
+}
+
+int ps_apply(int fd, int size) {
+	if (size == 0) {
+		size = session;
+	}
+	if (size <= 0) {
+		return 0;
+	}
+	if (size > ps_max_size()) {
+		size = ps_max_size();
+	}
+	return fcntl(fd, F_SETPIPE_SZ, size) == -1 ? -1 : 0;
+}
+
+int ps_adaptive() {
+	return session == PS_AUTO;
+}
+
+int ps_watch(int fd, pid_t reader) {
+	watch * tmp;
+	int capacity;
+
+	if (watches_count == watches_capacity) {
+		capacity = watches_capacity ? 2 * watches_capacity : 8;
+		tmp = realloc(watches, capacity * sizeof(watch));
+		if (tmp == NULL) {
+			return -1;
+		}
+		watches = tmp;
+		watches_capacity = capacity;
+	}
+	fd = fcntl(fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+	if (fd == -1) {
+		return -1;
+	}
+	watches[watches_count].fd = fd;
+	watches[watches_count].reader = reader;
+	++watches_count;
+	return 0;
+}
+
+int ps_watching() {
+	return watches_count > 0;
+}
+
+static void _ps_unwatch(watch * w) {
+	int result;
+
+	if (w->fd != -1) {
+		EINTR_RETRY(result, close(w->fd));
+		w->fd = -1;
+	}
+}
+
+/* May run in the SIGCHLD handler, only closes descriptors */
+void ps_reaped(pid_t pid, int return_status) {
+	int i;
+
+	for (i = 0; i < watches_count; ++i) {
+		if (watches[i].reader == pid) {
+			_ps_unwatch(&watches[i]);
+		}
+	}
+}
+
+void ps_adapt() {
+	int i, capacity, queued, max;
+
+	max = ps_max_size();
+	for (i = 0; i < watches_count; ++i) {
+		if (watches[i].fd == -1) {
+			continue;
+		}
+		capacity = fcntl(watches[i].fd, F_GETPIPE_SZ);
+		if (capacity == -1 || ioctl(watches[i].fd, FIONREAD, &queued) == -1) {
+			_ps_unwatch(&watches[i]);
+			continue;
+		}
+		if (capacity - queued >= PIPE_BUF) {
+			continue;
+		}
+		capacity = capacity > max / 2 ? max : 2 * capacity;
+		if (fcntl(watches[i].fd, F_SETPIPE_SZ, capacity) == -1 || capacity == max) {
+			_ps_unwatch(&watches[i]); /* can't grow any more */
+		}
+	}
+}
+
+#else /* !HAVE_PIPE_SIZE */
+
+int ps_max_size() {
+	return 0;
+}
+
+int ps_apply(int fd, int size) {
+	return 0;
+}
+
+int ps_adaptive() {
+	return 0;
+}
+
+int ps_watch(int fd, pid_t reader) {
+	return -1;
+}
+
+int ps_watching() {
+	return 0;
+}
+
+void ps_reaped(pid_t pid, int return_status) {
+}
+
+void ps_adapt() {
+}
+
+static void _ps_unwatch(watch * w) {
+}
+
+#endif /* HAVE_PIPE_SIZE */
+
+void ps_unwatch_all() {
+	int i;
+
+	for (i = 0; i < watches_count; ++i) {
+		_ps_unwatch(&watches[i]);
+	}
+	watches_count = 0;
+}
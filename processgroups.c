@@ -8,34 +8,62 @@
 #include <errno.h>
 #include <assert.h>
 #include <unistd.h>
+#include <poll.h>
 
+#include "config.h"
 #include "utils.h"
 #include "processgroups.h"
+#include "trace.h"
+
+#if USE_SIGNALFD && defined(__linux__)
+#define HAVE_SIGNALFD 1
+#include <sys/signalfd.h>
+#endif
 
 typedef struct process {
-	pid_t pid;
+	pid_t pid;                  /* 0 for a free slot */
 	int pgn;
 	int running;
 	int return_status;
 	void (*callback)(pid_t, int);
+	int next;                   /* next process of the group or next free slot */
 } process;
 
 typedef struct group
 {
-	int pgn;
+	int pgn;                    /* 0 for a free slot */
 	pid_t pid;
 	int num_processes;
 	int running;
 	void (*callback)(int);
+	int background;
+	int return_status;          /* of the last process of the pipeline */
+	int first_process;          /* -1 if group has no processes, the list
+	                               starts with the most recently added */
+	int next_free;
 } group;
 
+/* Open addressing index from a key (pid or pgn) to a slot of the processes or
+   groups array. It is resized only with SIGCHLD blocked, the handler only
+   looks up and removes entries, so it never allocates in signal context. */
+typedef struct slot_index {
+	int * slots;                /* -1 for an empty place */
+	int mask;                   /* size - 1, size is a power of two */
+	long (*key)(int slot);
+} slot_index;
+
+static long _pg_group_key(int slot);
+static long _pg_process_key(int slot);
+
 static group * groups = NULL;
-static int groups_size = 0;
 static int groups_cap = 0;
+static int groups_free = -1;
+static slot_index groups_index = {NULL, 0, _pg_group_key};
 
 static process * processes = NULL;
-static int processes_size = 0;
 static int processes_cap = 0;
+static int processes_free = -1;
+static slot_index processes_index = {NULL, 0, _pg_process_key};
 
 static int pg_num = 0;                  /* for generating next number of group */
 static int sigchld_blocked_counter = 0; /* counter for nested sigchld block/unblock */
@@ -46,32 +74,249 @@ static sigset_t old_sigset;             /* old set before pg_block_sigchld */
 static volatile int got_sigchld;        /* for pg_wait_for_sigchld to distinct between signals */
 static int foreground_pgn = 0;
 static int initialized = 0;				/* for pg_clean and pg_init */
+static int sigchld_fd = -1;             /* signalfd in event mode, SIGCHLD then stays blocked */
+static int background_running = 0;      /* running groups marked as background */
+static int max_background = 0;          /* limit for pg_wait_background_slot, 0 for none */
 
-group * _pg_get_group(int pgn) {
+/* Finished background groups not waited for yet, the oldest are dropped
+   when it's full. pgn 0 marks an entry already taken by pg_wait_job. */
+static struct {
+	int pgn;
+	int return_status;
+} finished_jobs[FINISHED_JOBS_SIZE];
+static int finished_head = 0;
+static int finished_count = 0;
+
+static long _pg_group_key(int slot) {
+	return groups[slot].pgn;
+}
+
+/* only running processes are indexed, the pid of a reaped one may be reused */
+static long _pg_process_key(int slot) {
+	return processes[slot].running ? processes[slot].pid : 0;
+}
+
+static int _idx_hash(slot_index * idx, long key) {
+	unsigned long h = (unsigned long) key * 2654435761UL;
+	return (int) ((h ^ (h >> 16)) & idx->mask);
+}
+
+/* Returns the place of key in the index or the empty place where it belongs */
+static int _idx_pos(slot_index * idx, long key) {
 	int i;
-	for (i = 0; i < groups_size; ++i) {
-		if (groups[i].pgn == pgn) {
-			return groups + i;
+	for (i = _idx_hash(idx, key); idx->slots[i] != -1; i = (i + 1) & idx->mask) {
+		if (idx->key(idx->slots[i]) == key) {
+			break;
 		}
 	}
-	return NULL;
+	return i;
 }
 
-void pg_wait_for_sigchld() {
+static int _idx_find(slot_index * idx, long key) {
+	if (idx->slots == NULL) {
+		return -1;
+	}
+	return idx->slots[_idx_pos(idx, key)];
+}
+
+static void _idx_insert(slot_index * idx, int slot) {
+	idx->slots[_idx_pos(idx, idx->key(slot))] = slot;
+}
+
+/* Backward shift deletion, keeps probe sequences intact without tombstones */
+static void _idx_remove(slot_index * idx, long key) {
+	int i, j, k;
+
+	i = _idx_pos(idx, key);
+	if (idx->slots[i] == -1) {
+		return;
+	}
+	for (j = (i + 1) & idx->mask; idx->slots[j] != -1; j = (j + 1) & idx->mask) {
+		k = _idx_hash(idx, idx->key(idx->slots[j]));
+		if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+			idx->slots[i] = idx->slots[j];
+			i = j;
+		}
+	}
+	idx->slots[i] = -1;
+}
+
+/* Makes the index at least twice as big as cap and reinserts used slots */
+static int _idx_reserve(slot_index * idx, int cap) {
+	int size, i, * slots;
+
+	for (size = 16; size < 2 * cap; size *= 2);
+	if (idx->slots != NULL && size <= idx->mask + 1) {
+		return 0;
+	}
+
+	slots = (int *) malloc(sizeof(int) * size);
+	if (slots == NULL) {
+		return -1;
+	}
+	free(idx->slots);
+	idx->slots = slots;
+	idx->mask = size - 1;
+	for (i = 0; i < size; ++i) {
+		slots[i] = -1;
+	}
+	for (i = 0; i < cap; ++i) {
+		if (idx->key(i) != 0) {
+			_idx_insert(idx, i);
+		}
+	}
+	return 0;
+}
+
+static int _pg_grow_groups() {
+	int slot, cap;
+	group * tmp;
+
+	cap = groups_cap ? groups_cap + groups_cap / 2 : 10;
+	tmp = (group *) realloc(groups, sizeof(group) * cap);
+	if (tmp == NULL) {
+		return -1;
+	}
+	groups = tmp;
+	for (slot = cap - 1; slot >= groups_cap; --slot) {
+		groups[slot].pgn = 0;
+		groups[slot].next_free = groups_free;
+		groups_free = slot;
+	}
+	groups_cap = cap;
+	return _idx_reserve(&groups_index, groups_cap);
+}
+
+static int _pg_alloc_group() {
+	int slot;
+
+	if (groups_free == -1 && _pg_grow_groups() == -1) {
+		return -1;
+	}
+	slot = groups_free;
+	groups_free = groups[slot].next_free;
+	return slot;
+}
+
+static int _pg_grow_processes() {
+	int slot, cap;
+	process * tmp;
+
+	cap = processes_cap ? processes_cap + processes_cap / 2 : 30;
+	tmp = (process *) realloc(processes, sizeof(process) * cap);
+	if (tmp == NULL) {
+		return -1;
+	}
+	processes = tmp;
+	for (slot = cap - 1; slot >= processes_cap; --slot) {
+		processes[slot].pid = 0;
+		processes[slot].running = 0;
+		processes[slot].next = processes_free;
+		processes_free = slot;
+	}
+	processes_cap = cap;
+	return _idx_reserve(&processes_index, processes_cap);
+}
+
+static int _pg_alloc_process() {
+	int slot;
+
+	if (processes_free == -1 && _pg_grow_processes() == -1) {
+		return -1;
+	}
+	slot = processes_free;
+	processes_free = processes[slot].next;
+	return slot;
+}
+
+group * _pg_get_group(int pgn) {
+	int slot = _idx_find(&groups_index, pgn);
+	return slot != -1 ? groups + slot : NULL;
+}
+
+/* Waits for SIGCHLD, or at most timeout milliseconds when reaping through
+   signalfd */
+static void _pg_wait_for_sigchld(int timeout) {
+	struct pollfd pfd;
+	int result;
+
 	pg_block_sigchld();
 
-	got_sigchld = 0;
-	while (!got_sigchld) {
-		sigsuspend(&old_sigset);
+	if (sigchld_fd != -1) {
+		pfd.fd = sigchld_fd;
+		pfd.events = POLLIN;
+		EINTR_RETRY(result, poll(&pfd, 1, timeout));
+		if (result != 0) {
+			pg_reap();
+		}
+	} else {
+		got_sigchld = 0;
+		while (!got_sigchld) {
+			sigsuspend(&old_sigset);
+		}
 	}
 
 	pg_unblock_sigchld();
 }
 
+void pg_wait_for_sigchld() {
+	_pg_wait_for_sigchld(-1);
+}
+
+int pg_wait_fd(int fd) {
+	struct pollfd pfd[2];
+	int result;
+
+	if (sigchld_fd == -1) {
+		return 0; /* the handler reaps children while the caller blocks in read */
+	}
+
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sigchld_fd;
+	pfd[1].events = POLLIN;
+	do {
+		EINTR_RETRY(result, poll(pfd, 2, -1));
+		if (result == -1) {
+			return -1;
+		}
+		if (pfd[1].revents) {
+			pg_reap();
+		}
+	} while (!pfd[0].revents);
+	return 0;
+}
+
+int pg_poll(struct pollfd * fds, nfds_t n) {
+	sigset_t sigset;
+	int result, saved_errno;
+
+	if (sigchld_fd != -1) {
+		fds[n].fd = sigchld_fd;
+		fds[n].events = POLLIN;
+		fds[n].revents = 0;
+		result = poll(fds, n + 1, -1);
+		if (result > 0 && fds[n].revents) {
+			pg_reap();
+			--result;
+		}
+		return result;
+	}
+	if (sigchld_blocked_counter == 0) {
+		return poll(fds, n, -1);
+	}
+	assert(sigprocmask(SIG_SETMASK, &old_sigset, &sigset) == 0);
+	result = poll(fds, n, -1);
+	saved_errno = errno;
+	assert(sigprocmask(SIG_SETMASK, &sigset, NULL) == 0);
+	errno = saved_errno;
+	return result;
+}
+
 void pg_block_sigchld() {
 	sigset_t sigset;
 
-	if (!sigchld_blocked_counter) {
+	if (!sigchld_blocked_counter && sigchld_fd == -1) {
 		assert(sigemptyset(&sigset) == 0);
 		assert(sigaddset(&sigset, SIGCHLD) == 0);
 		assert(sigprocmask(SIG_BLOCK, &sigset, &old_sigset) == 0);
@@ -88,7 +333,7 @@ void pg_unblock_sigchld() {
 	}
 
 	--sigchld_blocked_counter;
-	if (!sigchld_blocked_counter) {
+	if (!sigchld_blocked_counter && sigchld_fd == -1) {
 		assert(sigemptyset(&sigset) == 0);
 		assert(sigaddset(&sigset, SIGCHLD) == 0);
 		result = sigismember(&old_sigset, SIGCHLD);
@@ -99,41 +344,110 @@ void pg_unblock_sigchld() {
 	}
 }
 
-void sigchld_handler(int signo, siginfo_t * info, void * context) {
+static void _pg_push_finished(int pgn, int return_status) {
+	int i;
+
+	if (finished_count == FINISHED_JOBS_SIZE) {
+		finished_head = (finished_head + 1) % FINISHED_JOBS_SIZE;
+		--finished_count;
+	}
+	i = (finished_head + finished_count) % FINISHED_JOBS_SIZE;
+	finished_jobs[i].pgn = pgn;
+	finished_jobs[i].return_status = return_status;
+	++finished_count;
+}
+
+/* Takes the oldest finished job, or the one with given pgn if pgn != 0.
+   Returns -1 if there is no such job. */
+static int _pg_pop_finished(int pgn, int * pgn_out, int * return_status) {
+	int i, j, found;
+
+	found = -1;
+	for (i = 0; i < finished_count; ++i) {
+		j = (finished_head + i) % FINISHED_JOBS_SIZE;
+		if (finished_jobs[j].pgn != 0 && (pgn == 0 || finished_jobs[j].pgn == pgn)) {
+			*pgn_out = finished_jobs[j].pgn;
+			*return_status = finished_jobs[j].return_status;
+			finished_jobs[j].pgn = 0;
+			found = 0;
+			break;
+		}
+	}
+	while (finished_count > 0 && finished_jobs[finished_head].pgn == 0) {
+		finished_head = (finished_head + 1) % FINISHED_JOBS_SIZE;
+		--finished_count;
+	}
+	return found;
+}
+
+/* Collects all finished children and runs their callbacks */
+void _pg_reap() {
 	pid_t child_pid;
-	int i, return_status;
+	int slot, return_status;
+	process * p;
 	group * g;
 
-	got_sigchld = 1;
-
 	do {
 		EINTR_RETRY(child_pid, waitpid((pid_t)(-1), &return_status, WNOHANG));
 
 		assert(child_pid != -1 || errno == ECHILD);
+		if (child_pid > 0 && tr_enabled) {
+			tr_exit(child_pid, return_status);
+		}
 
-		for (i = 0; child_pid > 0 && i < processes_size; ++i) {
-			if (processes[i].pid == child_pid) {
-				g = _pg_get_group(processes[i].pgn);
-				assert(g != NULL);
-				g->running -= 1;
-				processes[i].running = 0;
-				processes[i].return_status = return_status;
-				if (processes[i].callback != NULL) {
-					(processes[i].callback)(child_pid, return_status);
+		slot = child_pid > 0 ? _idx_find(&processes_index, child_pid) : -1;
+		if (slot != -1) {
+			p = processes + slot;
+			g = _pg_get_group(p->pgn);
+			assert(g != NULL);
+			_idx_remove(&processes_index, child_pid);
+			g->running -= 1;
+			p->running = 0;
+			p->return_status = return_status;
+			if (g->first_process == slot) {
+				g->return_status = return_status;
+			}
+			if (p->callback != NULL) {
+				(p->callback)(child_pid, return_status);
+			}
+			if (g->running == 0) {
+				if (g->background) {
+					--background_running;
+					_pg_push_finished(g->pgn, g->return_status);
 				}
-				if (g->running == 0) {
-					if (g->callback != NULL) {
-						(g->callback)(g->pgn);
-					} else {
-						pg_del(g->pgn);
-					}
+				if (g->callback != NULL) {
+					(g->callback)(g->pgn);
+				} else {
+					pg_del(g->pgn);
 				}
-				break;
 			}
 		}
 	} while (child_pid > 0);
 }
 
+void sigchld_handler(int signo, siginfo_t * info, void * context) {
+	got_sigchld = 1;
+	_pg_reap();
+}
+
+void pg_reap() {
+#ifdef HAVE_SIGNALFD
+	struct signalfd_siginfo info;
+	int result;
+#endif
+
+	pg_block_sigchld();
+#ifdef HAVE_SIGNALFD
+	if (sigchld_fd != -1) {
+		do {
+			EINTR_RETRY(result, read(sigchld_fd, &info, sizeof(info)));
+		} while (result > 0);
+	}
+#endif
+	_pg_reap();
+	pg_unblock_sigchld();
+}
+
 void sigint_handler(int signo, siginfo_t * info, void * context) {
 #if _POSIX_VERSION < 200809L
 	if (foreground_pgn != 0) {
@@ -168,19 +482,17 @@ int pg_init() {
 	assert(sigaddset(&sa.sa_mask, SIGCHLD) == 0);
 	assert(sigaction(SIGINT, &sa, &old_sa_int) == 0);
 
-	processes_cap = 30;
-	processes_size = 0;
-	pg_num = 1;
-	processes = (process *) malloc(sizeof(process) * processes_cap);
-	if (processes == NULL) {
-		goto error;
-	}
+#ifdef HAVE_SIGNALFD
+	/* event mode: SIGCHLD stays blocked and children are reaped in normal
+	   context when the signalfd becomes readable, the handler is only a
+	   fallback if it ever gets unblocked */
+	assert(sigemptyset(&sa.sa_mask) == 0);
+	assert(sigaddset(&sa.sa_mask, SIGCHLD) == 0);
+	sigchld_fd = signalfd(-1, &sa.sa_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+#endif
 
-	groups_cap = 10;
-	groups_size = 0;
 	pg_num = 1;
-	groups = (group *) malloc(sizeof(group) * groups_cap);
-	if (groups == NULL) {
+	if (_pg_grow_groups() == -1 || _pg_grow_processes() == -1) {
 		goto error;
 	}
 
@@ -192,6 +504,10 @@ error:
 	return -1;
 }
 
+int pg_initialized() {
+	return initialized;
+}
+
 void pg_clean() {
 	if (initialized == 0) {
 		return;
@@ -202,6 +518,11 @@ void pg_clean() {
 	assert(sigaction(SIGCHLD, &old_sa_chld, NULL) == 0);
 	assert(sigaction(SIGINT, &old_sa_int, NULL) == 0);
 
+	if (sigchld_fd != -1) {
+		close(sigchld_fd); /* ignore errors */
+		sigchld_fd = -1;
+		sigchld_blocked_counter = 1; /* SIGCHLD has been blocked since pg_init */
+	}
 	if (sigchld_blocked_counter > 0) {
 		sigchld_blocked_counter = 1;
 		pg_unblock_sigchld();
@@ -209,27 +530,42 @@ void pg_clean() {
 
 	free(processes);
 	free(groups);
+	free(processes_index.slots);
+	free(groups_index.slots);
 	processes = NULL;
 	groups = NULL;
+	processes_index.slots = NULL;
+	groups_index.slots = NULL;
+	processes_cap = groups_cap = 0;
+	processes_free = groups_free = -1;
+
+	/* a forked child starts with no jobs of its own */
+	pg_num = 0;
+	foreground_pgn = 0;
+	background_running = 0;
+	max_background = 0;
+	finished_head = finished_count = 0;
 }
 
 int pg_new(void (*f)(int)) {
+	int slot;
+
 	pg_block_sigchld();
 
-	if (groups_size == groups_cap) {
-		groups_cap += groups_cap / 2;
-		groups = realloc(groups, sizeof(group) * groups_cap);
-		if (groups == NULL) {
-			goto error;
-		}
+	slot = _pg_alloc_group();
+	if (slot == -1) {
+		goto error;
 	}
 
-	groups[groups_size].pgn = pg_num;
-	groups[groups_size].num_processes = 0;
-	groups[groups_size].running = 0;
-	groups[groups_size].pid = 0;
-	groups[groups_size].callback = f;
-	++groups_size;
+	groups[slot].pgn = pg_num;
+	groups[slot].num_processes = 0;
+	groups[slot].running = 0;
+	groups[slot].pid = 0;
+	groups[slot].callback = f;
+	groups[slot].background = 0;
+	groups[slot].return_status = 0;
+	groups[slot].first_process = -1;
+	_idx_insert(&groups_index, slot);
 
 	pg_unblock_sigchld();
 	return pg_num++;
@@ -239,28 +575,37 @@ error:
 }
 
 void pg_del(int pgn) {
-	int i;
-	group * g;
+	int slot, i, next;
 
 	pg_block_sigchld();
 
-	g = _pg_get_group(pgn);
-	if (g != NULL) {
-		--groups_size;
-		*g = groups[groups_size];
-	}
-
-	for (i = processes_size - 1; i >= 0; --i) {
-		if (processes[i].pgn == pgn) {
-			--processes_size;
-			processes[i] = processes[processes_size];
+	slot = _idx_find(&groups_index, pgn);
+	if (slot != -1) {
+		for (i = groups[slot].first_process; i != -1; i = next) {
+			next = processes[i].next;
+			if (processes[i].running) {
+				_idx_remove(&processes_index, processes[i].pid);
+			}
+			processes[i].pid = 0;
+			processes[i].running = 0;
+			processes[i].next = processes_free;
+			processes_free = i;
 		}
+		if (groups[slot].background && groups[slot].running) {
+			--background_running;
+		}
+		_idx_remove(&groups_index, pgn);
+		groups[slot].pgn = 0;
+		groups[slot].next_free = groups_free;
+		groups_free = slot;
 	}
+
 	pg_unblock_sigchld();
 }
 
 int pg_add_process(int pgn, pid_t pid, void (*f)(pid_t, int)) {
 	group * g;
+	int slot;
 
 	pg_block_sigchld();
 
@@ -268,9 +613,17 @@ int pg_add_process(int pgn, pid_t pid, void (*f)(pid_t, int)) {
 	if (g == NULL) {
 		goto error;
 	}
+	slot = _pg_alloc_process();
+	if (slot == -1) {
+		goto error;
+	}
+
 	if (g->pid == 0) {
 		g->pid = pid;
 	}
+	if (g->background && g->running == 0) {
+		++background_running;
+	}
 	g->num_processes += 1;
 	g->running += 1;
 
@@ -278,20 +631,14 @@ int pg_add_process(int pgn, pid_t pid, void (*f)(pid_t, int)) {
 	setpgid(pid, g->pid); /* ignore errors */
 #endif
 
-	if (processes_size == processes_cap) {
-		processes_cap += processes_cap / 2;
-		processes = realloc(processes, sizeof(process) * processes_cap);
-		if (processes == NULL) {
-			goto error;
-		}
-	}
-
-	processes[processes_size].pgn = pgn;
-	processes[processes_size].pid = pid;
-	processes[processes_size].running = 1;
-	processes[processes_size].return_status = 0;
-	processes[processes_size].callback = f;
-	++processes_size;
+	processes[slot].pgn = pgn;
+	processes[slot].pid = pid;
+	processes[slot].running = 1;
+	processes[slot].return_status = 0;
+	processes[slot].callback = f;
+	processes[slot].next = g->first_process;
+	g->first_process = slot;
+	_idx_insert(&processes_index, slot);
 
 	pg_unblock_sigchld();
 	return 0;
@@ -314,23 +661,46 @@ int pg_running(int pgn) {
 }
 
 void pg_wait(int pgn) {
+	pg_wait_polling(pgn, -1, NULL);
+}
+
+void pg_wait_polling(int pgn, int interval, void (*f)()) {
+	double start;
+
+	start = tr_start();
 	pg_block_sigchld();
 	while (pg_running(pgn)) {
-		pg_wait_for_sigchld();
+		_pg_wait_for_sigchld(f != NULL ? interval : -1);
+		if (f != NULL && pg_running(pgn)) {
+			f();
+		}
 	}
 	pg_unblock_sigchld();
+	if (tr_enabled) {
+		tr_complete("wait", start, 0, NULL);
+	}
 }
 
 void pg_kill(int pgn, int signal) {
+	group * g;
+#if _POSIX_VERSION < 200809L
 	int i;
+#endif
 
 	pg_block_sigchld();
 
-	for (i = processes_size - 1; i >= 0; --i) {
-		if (processes[i].pgn == pgn && processes[i].running) {
+	g = _pg_get_group(pgn);
+#if _POSIX_VERSION >= 200809L
+	if (g != NULL && g->pid > 0 && g->running) {
+		kill(-g->pid, signal); /* ignore errors */
+	}
+#else
+	for (i = g != NULL ? g->first_process : -1; i != -1; i = processes[i].next) {
+		if (processes[i].running) {
 			kill(processes[i].pid, signal); /* ignore errors */
 		}
 	}
+#endif
 
 	pg_unblock_sigchld();
 }
@@ -359,3 +729,122 @@ int pg_foreground(int pgn) {
 error:
 	return -1;
 }
+
+int pg_spawn_sigsets(sigset_t * sigdefault, sigset_t * sigmask) {
+	assert(sigemptyset(sigdefault) == 0);
+	assert(sigprocmask(SIG_SETMASK, NULL, sigmask) == 0);
+
+	if (initialized == 0) {
+		return 0;
+	}
+
+	/* exec resets caught signals to default, but ignored ones stay ignored
+	   and posix_spawn can't restore SIG_IGN */
+	if (old_sa_chld.sa_handler == SIG_IGN || old_sa_int.sa_handler == SIG_IGN) {
+		return -1;
+	}
+	if (old_sa_ttou.sa_handler != SIG_IGN) {
+		assert(sigaddset(sigdefault, SIGTTOU) == 0);
+	}
+
+	if ((sigchld_blocked_counter > 0 || sigchld_fd != -1) && !sigismember(&old_sigset, SIGCHLD)) {
+		assert(sigdelset(sigmask, SIGCHLD) == 0);
+	}
+	return 0;
+}
+
+void pg_set_background(int pgn, int background) {
+	group * g;
+
+	pg_block_sigchld();
+
+	g = _pg_get_group(pgn);
+	if (g != NULL && !g->background != !background) {
+		g->background = background != 0;
+		if (g->running) {
+			background_running += g->background ? 1 : -1;
+		}
+	}
+
+	pg_unblock_sigchld();
+}
+
+void pg_set_max_background(int max) {
+	max_background = max > 0 ? max : 0;
+}
+
+int pg_max_background() {
+	return max_background;
+}
+
+void pg_wait_background_slot() {
+	pg_block_sigchld();
+	while (max_background > 0 && background_running >= max_background) {
+		pg_wait_for_sigchld();
+	}
+	pg_unblock_sigchld();
+}
+
+void pg_foreach_background(void (*f)(int pgn, pid_t pid)) {
+	int i;
+
+	pg_block_sigchld();
+	for (i = 0; i < groups_cap; ++i) {
+		if (groups[i].pgn != 0 && groups[i].background && groups[i].running) {
+			f(groups[i].pgn, groups[i].pid);
+		}
+	}
+	pg_unblock_sigchld();
+}
+
+int pg_last_background() {
+	int i, pgn;
+
+	pg_block_sigchld();
+	pgn = -1;
+	for (i = 0; i < groups_cap; ++i) {
+		if (groups[i].pgn > pgn && groups[i].background && groups[i].running) {
+			pgn = groups[i].pgn;
+		}
+	}
+	pg_unblock_sigchld();
+	return pgn;
+}
+
+int pg_wait_job(int pgn, int * return_status) {
+	group * g;
+	int found;
+
+	pg_block_sigchld();
+
+	g = _pg_get_group(pgn);
+	if (g != NULL && g->background) {
+		while (pg_running(pgn)) {
+			pg_wait_for_sigchld();
+		}
+	}
+	found = _pg_pop_finished(pgn, &pgn, return_status);
+
+	pg_unblock_sigchld();
+	return found;
+}
+
+int pg_wait_any(int * pgn, int * return_status) {
+	int result;
+
+	pg_block_sigchld();
+	while ((result = _pg_pop_finished(0, pgn, return_status)) == -1 && background_running > 0) {
+		pg_wait_for_sigchld();
+	}
+	pg_unblock_sigchld();
+	return result;
+}
+
+void pg_wait_all() {
+	pg_block_sigchld();
+	while (background_running > 0) {
+		pg_wait_for_sigchld();
+	}
+	finished_head = finished_count = 0;
+	pg_unblock_sigchld();
+}
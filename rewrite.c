@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "siparse.h"
+#include "rewrite.h"
+
+static int mode = REWRITE_PIPELINES;
+
+void rw_set_mode(int new_mode) {
+	mode = new_mode;
+}
+
+int rw_mode() {
+	return mode;
+}
+
+static int _rw_is_cat(command * com, int argc) {
+	int i;
+
+	if (com->argv[0] == NULL || strcmp(com->argv[0], "cat") != 0 || com->redirs[0] != NULL) {
+		return 0;
+	}
+	for (i = 1; com->argv[i] != NULL; ++i) {
+		if (com->argv[i][0] == '-') {
+			return 0;
+		}
+	}
+	return i == argc;
+}
+
+static int _rw_has_input(command * com) {
+	redirection ** redir;
+
+	for (redir = com->redirs; *redir != NULL; ++redir) {
+		if ((*redir)->flags & RIN) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Removes stage i from the pipeline */
+static void _rw_drop(pipeline pl, int i) {
+	for (; pl[i] != NULL; ++i) {
+		pl[i] = pl[i + 1];
+	}
+}
+
+/* cat FILE | cmd  ->  cmd < FILE */
+static int _rw_head_cat(line * ln, pipeline pl) {
+	redirection * redir;
+	redirection ** redirs;
+	int n;
+
+	if (!_rw_is_cat(pl[0], 2) || pl[1] == NULL || pl[1]->argv[0] == NULL || _rw_has_input(pl[1])) {
+		return 0;
+	}
+	if (mode == RW_DRY) {
+		fprintf(stderr, "rewrite: cat %s | %s -> %s < %s\n", pl[0]->argv[1], pl[1]->argv[0],
+		    pl[1]->argv[0], pl[0]->argv[1]);
+		return 0;
+	}
+
+	for (n = 0; pl[1]->redirs[n] != NULL; ++n);
+	redir = linealloc(ln, sizeof(redirection));
+	redirs = linealloc(ln, (n + 2) * sizeof(redirection *));
+	if (redir == NULL || redirs == NULL) {
+		return -1;
+	}
+	redir->filename = pl[0]->argv[1];
+	redir->flags = RIN;
+	redirs[0] = redir;
+	memcpy(redirs + 1, pl[1]->redirs, (n + 1) * sizeof(redirection *));
+	pl[1]->redirs = redirs;
+
+	_rw_drop(pl, 0);
+	return 1;
+}
+
+/* a | cat | b  ->  a | b */
+static int _rw_middle_cat(pipeline pl) {
+	int i;
+
+	for (i = 1; pl[i] != NULL && pl[i + 1] != NULL; ++i) {
+		if (_rw_is_cat(pl[i], 1)) {
+			if (mode == RW_DRY) {
+				fprintf(stderr, "rewrite: %s | cat | %s -> %s | %s\n", pl[i - 1]->argv[0],
+				    pl[i + 1]->argv[0], pl[i - 1]->argv[0], pl[i + 1]->argv[0]);
+				continue;
+			}
+			if (pl[i]->pipesize > pl[i + 1]->pipesize) {
+				pl[i + 1]->pipesize = pl[i]->pipesize;
+			}
+			_rw_drop(pl, i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int rw_line(line * ln) {
+	pipeline * pl;
+	int count, result;
+
+	if (mode == RW_OFF) {
+		return 0;
+	}
+
+	count = 0;
+	for (pl = ln->pipelines; *pl != NULL; ++pl) {
+		do {
+			result = _rw_middle_cat(*pl);
+			if (result == 0) {
+				result = _rw_head_cat(ln, *pl);
+			}
+			if (result == -1) {
+				return -1;
+			}
+			count += result;
+		} while (result > 0);
+	}
+	if (mode == RW_DRY) {
+		fflush(stderr);
+	}
+	return count;
+}
@@ -0,0 +1,244 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "config.h"
+#include "utils.h"
+#include "siparse.h"
+#include "substitution.h"
+
+#define SB_NAME_SIZE (sizeof(PROCESS_SUBSTITUTION_DIR) + 12) /* fits any fd */
+
+typedef struct sb_fd {
+	int fd;
+	command * owner;  /* expanded command, NULL for the substitution's end */
+} sb_fd;
+
+/* Pipe ends the shell holds for expanded commands */
+static sb_fd * open_fds = NULL;
+static int open_count = 0;
+static int open_capacity = 0;
+
+static int _sb_is_substitution(const char * word) {
+	return (word[0] == '<' || word[0] == '>') && word[1] == '('
+	  && word[strlen(word) - 1] == ')';
+}
+
+/* The word of a here-document or here-string is never expanded */
+static int _sb_redir_is_substitution(redirection * redir) {
+	return !IS_RHEREDOC(redir->flags) && !IS_RHERESTR(redir->flags)
+	  && _sb_is_substitution(redir->filename);
+}
+
+int sb_has(command * com) {
+	char ** arg;
+	redirection ** redir;
+
+	for (arg = com->argv; *arg != NULL; ++arg) {
+		if (_sb_is_substitution(*arg)) {
+			return 1;
+		}
+	}
+	for (redir = com->redirs; *redir != NULL; ++redir) {
+		if (_sb_redir_is_substitution(*redir)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int _sb_register(int fd, command * owner) {
+	sb_fd * tmp;
+	int capacity;
+
+	if (open_count == open_capacity) {
+		capacity = open_capacity ? 2 * open_capacity : 8;
+		tmp = realloc(open_fds, capacity * sizeof(sb_fd));
+		if (tmp == NULL) {
+			return -1;
+		}
+		open_fds = tmp;
+		open_capacity = capacity;
+	}
+	open_fds[open_count].fd = fd;
+	open_fds[open_count].owner = owner;
+	++open_count;
+	return 0;
+}
+
+static void _sb_close(int i) {
+	int result;
+
+	EINTR_RETRY(result, close(open_fds[i].fd));
+	open_fds[i] = open_fds[--open_count];
+}
+
+static void _sb_close_fd(int fd) {
+	int i;
+
+	for (i = 0; i < open_count; ++i) {
+		if (open_fds[i].fd == fd) {
+			_sb_close(i);
+			return;
+		}
+	}
+}
+
+/* Starts the substitution word and returns owner's end of its pipe */
+static int _sb_start(const char * word, command * owner, sb_start_func start, void * data) {
+	int p[2], input, inner, outer, result;
+	size_t length;
+	char * text;
+
+	if (pipe(p) == -1) {
+		return -1;
+	}
+	input = word[0] == '<'; /* the command reads what the substitution writes */
+	inner = input ? p[1] : p[0];
+	outer = input ? p[0] : p[1];
+	/* registered before start, so its forked builtins close them */
+	if (fcntl(p[0], F_SETFD, FD_CLOEXEC) == -1
+	  || fcntl(p[1], F_SETFD, FD_CLOEXEC) == -1
+	  || _sb_register(outer, owner) == -1) {
+		EINTR_RETRY(result, close(p[0]));
+		EINTR_RETRY(result, close(p[1]));
+		return -1;
+	}
+	if (_sb_register(inner, NULL) == -1) {
+		EINTR_RETRY(result, close(inner));
+		_sb_close_fd(outer);
+		return -1;
+	}
+
+	length = strlen(word) - 3;
+	text = malloc(length + 1);
+	if (text == NULL) {
+		goto error;
+	}
+	memcpy(text, word + 2, length);
+	text[length] = '\0';
+	result = start(text, input ? STDIN_FILENO : inner, input ? inner : STDOUT_FILENO, data);
+	free(text);
+	if (result == -1) {
+		goto error;
+	}
+
+	_sb_close_fd(inner);
+	return outer;
+error:
+	_sb_close_fd(inner);
+	_sb_close_fd(outer);
+	return -1;
+}
+
+/* Replaces *word with the name of a new substitution's pipe end */
+static int _sb_replace(char ** word, char * name, command * owner,
+    sb_start_func start, void * data) {
+	int fd;
+
+	fd = _sb_start(*word, owner, start, data);
+	if (fd == -1) {
+		return -1;
+	}
+	sprintf(name, "%s%d", PROCESS_SUBSTITUTION_DIR, fd);
+	*word = name;
+	return 0;
+}
+
+command * sb_expand(command * com, sb_start_func start, void * data) {
+	command * copy;
+	char ** argv, * names;
+	redirection ** redirs, * redir_copies;
+	int argc, redirc, i;
+
+	for (argc = 0; com->argv[argc] != NULL; ++argc);
+	for (redirc = 0; com->redirs[redirc] != NULL; ++redirc);
+
+	/* the copy, its arrays and the names of the pipes in one block */
+	copy = malloc(sizeof(command) + (argc + 1) * sizeof(char *)
+	  + (redirc + 1) * sizeof(redirection *) + redirc * sizeof(redirection)
+	  + (argc + redirc) * SB_NAME_SIZE);
+	if (copy == NULL) {
+		return NULL;
+	}
+	argv = (char **) (copy + 1);
+	redirs = (redirection **) (argv + argc + 1);
+	redir_copies = (redirection *) (redirs + redirc + 1);
+	names = (char *) (redir_copies + redirc);
+
+	*copy = *com;
+	copy->argv = argv;
+	copy->redirs = redirs;
+	memcpy(argv, com->argv, (argc + 1) * sizeof(char *));
+	for (i = 0; i < redirc; ++i) {
+		redir_copies[i] = *com->redirs[i];
+		redirs[i] = &redir_copies[i];
+	}
+	redirs[redirc] = NULL;
+
+	for (i = 0; i < argc; ++i) {
+		if (_sb_is_substitution(argv[i])) {
+			if (_sb_replace(&argv[i], names, copy, start, data) == -1) {
+				goto error;
+			}
+			names += SB_NAME_SIZE;
+		}
+	}
+	for (i = 0; i < redirc; ++i) {
+		if (_sb_redir_is_substitution(redirs[i])) {
+			if (_sb_replace(&redirs[i]->filename, names, copy, start, data) == -1) {
+				goto error;
+			}
+			names += SB_NAME_SIZE;
+		}
+	}
+	return copy;
+
+error:
+	sb_free(copy);
+	return NULL;
+}
+
+int sb_inherit(command * expanded) {
+	int i;
+
+	for (i = 0; i < open_count; ++i) {
+		if (open_fds[i].owner == expanded && fcntl(open_fds[i].fd, F_SETFD, 0) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void sb_free(command * expanded) {
+	int i;
+
+	if (expanded == NULL) {
+		return;
+	}
+	for (i = 0; i < open_count; ) {
+		if (open_fds[i].owner == expanded) {
+			_sb_close(i);
+		} else {
+			++i;
+		}
+	}
+	free(expanded);
+}
+
+void sb_close_others(command * keep) {
+	int i;
+
+	for (i = 0; i < open_count; ) {
+		if (open_fds[i].owner != keep) {
+			_sb_close(i);
+		} else {
+			++i;
+		}
+	}
+}
@@ -0,0 +1,212 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+
+#include "config.h"
+#include "utils.h"
+#include "trace.h"
+
+#define TR_BUFFER_SIZE 8192
+#define TR_EVENT_SIZE 256    /* upper bound of one formatted event */
+#define TR_DETAIL_LENGTH 64  /* longer details are truncated */
+
+int tr_enabled = 0;
+
+static int trace_fd = -1;
+static pid_t trace_pid;       /* the shell, children must not write */
+static char buffer[TR_BUFFER_SIZE];
+static size_t buffer_used = 0;
+static int first_event = 1;
+
+typedef struct exit_event {
+	double ts;
+	pid_t pid;
+	int return_status;
+} exit_event;
+
+/* Children reaped in the SIGCHLD handler can't be formatted there, they wait
+   in this ring until the next event written in normal context. Single
+   producer (the reaper, never reentered) and single consumer. */
+static volatile exit_event exits[TRACE_EXIT_RING_SIZE];
+static volatile sig_atomic_t exits_head = 0;
+static volatile sig_atomic_t exits_tail = 0;
+static volatile sig_atomic_t exits_lost = 0;
+
+double tr_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void _tr_flush() {
+	size_t written;
+	ssize_t result;
+
+	for (written = 0; written < buffer_used; written += result) {
+		EINTR_RETRY(result, write(trace_fd, buffer + written, buffer_used - written));
+		if (result <= 0) {
+			break; /* the trace is best effort */
+		}
+	}
+	buffer_used = 0;
+}
+
+/* Appends one event, fields is the JSON object without braces */
+static void _tr_append(const char * fields) {
+	size_t length;
+
+	length = strlen(fields);
+	if (buffer_used + length + 4 > TR_BUFFER_SIZE) {
+		_tr_flush();
+	}
+	if (!first_event) {
+		buffer[buffer_used++] = ',';
+	}
+	buffer[buffer_used++] = '\n';
+	buffer[buffer_used++] = '{';
+	memcpy(buffer + buffer_used, fields, length);
+	buffer_used += length;
+	buffer[buffer_used++] = '}';
+	first_event = 0;
+}
+
+static void _tr_drain_exits() {
+	char event[TR_EVENT_SIZE];
+	int head;
+
+	for (head = exits_head; head != exits_tail; head = (head + 1) % TRACE_EXIT_RING_SIZE) {
+		sprintf(event, "\"name\": \"exit\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": %ld, \"tid\": %ld, \"args\": {\"status\": %d}",
+		    exits[head].ts, (long) trace_pid, (long) exits[head].pid, exits[head].return_status);
+		_tr_append(event);
+	}
+	exits_head = head;
+}
+
+int tr_init(const char * file) {
+	if (file == NULL) {
+		return 0;
+	}
+
+	EINTR_RETRY(trace_fd, open(file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH));
+	if (trace_fd == -1 || fcntl(trace_fd, F_SETFD, FD_CLOEXEC) == -1) {
+		goto error;
+	}
+	trace_pid = getpid();
+	buffer[buffer_used++] = '[';
+	tr_enabled = 1;
+	atexit(tr_close);
+	return 0;
+error:
+	if (trace_fd != -1) {
+		close(trace_fd);
+		trace_fd = -1;
+	}
+	return -1;
+}
+
+void tr_close() {
+	char event[TR_EVENT_SIZE];
+
+	if (!tr_enabled || getpid() != trace_pid) {
+		return;
+	}
+	_tr_drain_exits();
+	if (exits_lost) {
+		sprintf(event, "\"name\": \"exits lost\", \"ph\": \"i\", \"s\": \"g\", \"ts\": %.3f, \"pid\": %ld, \"tid\": %ld, \"args\": {\"count\": %d}",
+		    tr_now(), (long) trace_pid, (long) trace_pid, (int) exits_lost);
+		_tr_append(event);
+	}
+	_tr_flush();
+	buffer[buffer_used++] = '\n';
+	buffer[buffer_used++] = ']';
+	buffer[buffer_used++] = '\n';
+	_tr_flush();
+	close(trace_fd);
+	trace_fd = -1;
+	tr_enabled = 0;
+}
+
+void tr_complete(const char * name, double start, pid_t tid, const char * detail) {
+	char event[TR_EVENT_SIZE];
+	int length;
+	size_t detail_length;
+
+	if (getpid() != trace_pid) {
+		return;
+	}
+	_tr_drain_exits();
+
+	length = sprintf(event, "\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %ld, \"tid\": %ld",
+	    name, start, tr_now() - start, (long) trace_pid, (long) (tid ? tid : trace_pid));
+	if (detail != NULL) {
+		/* quotes and backslashes would need escaping, cut the name there */
+		detail_length = strcspn(detail, "\"\\");
+		if (detail_length > TR_DETAIL_LENGTH) {
+			detail_length = TR_DETAIL_LENGTH;
+		}
+		sprintf(event + length, ", \"args\": {\"command\": \"%.*s\"}", (int) detail_length, detail);
+	}
+	_tr_append(event);
+}
+
+void tr_exit(pid_t pid, int return_status) {
+	int tail, next;
+
+	tail = exits_tail;
+	next = (tail + 1) % TRACE_EXIT_RING_SIZE;
+	if (next == exits_head) {
+		++exits_lost;
+		return;
+	}
+	exits[tail].ts = tr_now();
+	exits[tail].pid = pid;
+	exits[tail].return_status = return_status;
+	exits_tail = next;
+}
+
+void tr_exec_pipe(int p[2]) {
+	if (pipe(p) == -1) {
+		p[0] = p[1] = -1;
+		return;
+	}
+	if (fcntl(p[0], F_SETFD, FD_CLOEXEC) == -1 || fcntl(p[1], F_SETFD, FD_CLOEXEC) == -1) {
+		close(p[0]);
+		close(p[1]);
+		p[0] = p[1] = -1;
+	}
+}
+
+void tr_exec_failed(int p[2]) {
+	char c;
+	int result;
+
+	c = 1;
+	if (p[1] != -1) {
+		EINTR_RETRY(result, write(p[1], &c, 1));
+	}
+}
+
+void tr_exec_wait(int p[2], pid_t pid, double start, const char * name) {
+	char c;
+	int result;
+
+	if (p[0] == -1) {
+		return;
+	}
+	close(p[1]);
+	/* EOF once the child's copy of the write end is closed by exec */
+	EINTR_RETRY(result, read(p[0], &c, 1));
+	close(p[0]);
+	p[0] = p[1] = -1;
+
+	if (pid != -1) {
+		tr_complete(result == 1 ? "exec failed" : "exec", start, pid, name);
+	}
+}
@@ -6,3 +6,12 @@ void swap_ptr(void ** a, void ** b) {
 	*a = *b;
 	*b = tmp_ptr;
 }
+
+unsigned long hash_str(const char * str) {
+	unsigned long hash = 2166136261UL;
+	while (*str) {
+		hash ^= (unsigned char) *str++;
+		hash = (hash * 16777619UL) & 0xffffffffUL;
+	}
+	return hash;
+}